@@ -402,6 +402,10 @@ static const struct dri2_extension_match optional_core_extensions[] = {
    { __DRI2_FENCE, 1, offsetof(struct dri2_egl_display, fence) },
    { __DRI2_RENDERER_QUERY, 1, offsetof(struct dri2_egl_display, rendererQuery) },
    { __DRI2_INTEROP, 1, offsetof(struct dri2_egl_display, interop) },
+   { __DRI_COPY_SUB_BUFFER, 1, offsetof(struct dri2_egl_display, copy_sub_buffer) },
+#ifdef __DRI2_DAMAGE
+   { __DRI2_DAMAGE, 1, offsetof(struct dri2_egl_display, damage) },
+#endif
    { NULL, 0, 0 }
 };
 
@@ -664,6 +668,7 @@ dri2_setup_screen(_EGLDisplay *disp)
    }
 
    disp->Extensions.KHR_reusable_sync = EGL_TRUE;
+   disp->Extensions.MESA_swap_buffers_multi = EGL_TRUE;
 
    if (dri2_dpy->image) {//不会执行--start
       if (dri2_dpy->image->base.version >= 10 &&
@@ -852,6 +857,14 @@ dri2_initialize(_EGLDriver *drv, _EGLDisplay *disp)
       }
 
       dri2_dpy->ref_count++;
+
+      /* Errors only the driver can detect, such as EGL_BAD_MATCH for a GL
+       * version it cannot provide, then come from the first eglMakeCurrent
+       * (or EGLImage/interop call) instead of eglCreateContext. Apps that
+       * probe for the highest version by trying eglCreateContext will
+       * accept a context they cannot use.
+       */
+      dri2_dpy->lazy_context = getenv("EGL_LAZY_CONTEXT") != NULL;
    }
 
    return ret;
@@ -894,6 +907,7 @@ dri2_display_release(_EGLDisplay *disp)
    switch (disp->Platform) {
 #ifdef HAVE_X11_PLATFORM
    case _EGL_PLATFORM_X11:
+      dri2_teardown_x11(dri2_dpy);
       if (dri2_dpy->own_device) {
          xcb_disconnect(dri2_dpy->conn);
       }
@@ -953,6 +967,57 @@ dri2_terminate(_EGLDriver *drv, _EGLDisplay *disp)
    return EGL_TRUE;
 }
 
+/**
+ * Populate disp->Configs for platforms that skipped config enumeration in
+ * eglInitialize.  Only config queries can hand out EGLConfig handles, so
+ * every other entrypoint taking a config is covered by these two.
+ *
+ * add_configs only fails when it added nothing, so the next query simply
+ * tries again.
+ */
+static EGLBoolean
+dri2_add_deferred_configs(_EGLDriver *drv, _EGLDisplay *disp)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+
+   if (!dri2_dpy || !dri2_dpy->configs_deferred)
+      return EGL_TRUE;
+
+   dri2_dpy->configs_deferred = false;
+   if (!dri2_dpy->vtbl->add_configs(drv, disp)) {
+      dri2_dpy->configs_deferred = true;
+      return _eglError(EGL_NOT_INITIALIZED, "DRI2: failed to add configs");
+   }
+
+   return EGL_TRUE;
+}
+
+/**
+ * Called via eglGetConfigs(), drv->API.GetConfigs().
+ */
+static EGLBoolean
+dri2_get_configs(_EGLDriver *drv, _EGLDisplay *disp, EGLConfig *configs,
+                 EGLint config_size, EGLint *num_config)
+{
+   if (!dri2_add_deferred_configs(drv, disp))
+      return EGL_FALSE;
+   return _eglGetConfigs(drv, disp, configs, config_size, num_config);
+}
+
+/**
+ * Called via eglChooseConfig(), drv->API.ChooseConfig().
+ */
+static EGLBoolean
+dri2_choose_config(_EGLDriver *drv, _EGLDisplay *disp,
+                   const EGLint *attrib_list, EGLConfig *configs,
+                   EGLint config_size, EGLint *num_config)
+{
+   if (!dri2_add_deferred_configs(drv, disp))
+      return EGL_FALSE;
+   return _eglChooseConfig(drv, disp, attrib_list, configs, config_size,
+                           num_config);
+}
+
 /**
  * Set the error code after a call to
  * dri2_egl_display::dri2::createContextAttribs.
@@ -1066,6 +1131,105 @@ dri2_fill_context_attribs(struct dri2_egl_context *dri2_ctx,
    return true;
 }
 
+/**
+ * Whether the driver takes the attribute-list context constructor, which is
+ * the only one that understands dri2_fill_context_attribs' output.
+ */
+static bool
+dri2_has_create_context_attribs(struct dri2_egl_display *dri2_dpy)
+{
+   if (dri2_dpy->image_driver)
+      return true;
+   if (dri2_dpy->dri2)
+      return dri2_dpy->dri2->base.version >= 3;
+
+   assert(dri2_dpy->swrast);
+   return dri2_dpy->swrast->base.version >= 3;
+}
+
+static EGLBoolean
+dri2_destroy_context(_EGLDriver *drv, _EGLDisplay *disp, _EGLContext *ctx);
+
+/**
+ * Create the __DRIcontext backing an EGL context from the parameters
+ * dri2_create_context validated.  This happens in eglCreateContext, or in
+ * the first eglMakeCurrent when the display uses lazy contexts.
+ */
+static EGLBoolean
+dri2_realize_context(_EGLDriver *drv, _EGLDisplay *disp,
+                     struct dri2_egl_context *dri2_ctx)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+   struct dri2_egl_context *dri2_ctx_shared =
+      dri2_egl_context(dri2_ctx->shared);
+   __DRIcontext *shared = NULL;
+
+   if (dri2_ctx->dri_context)
+      return EGL_TRUE;
+
+   if (dri2_ctx_shared) {
+      if (!dri2_realize_context(drv, disp, dri2_ctx_shared))
+         return EGL_FALSE;
+      shared = dri2_ctx_shared->dri_context;
+   }
+
+   if (dri2_has_create_context_attribs(dri2_dpy)) {
+      __DRIcontext *(*create_context_attribs)(__DRIscreen *, int,
+                                              const __DRIconfig *,
+                                              __DRIcontext *, unsigned,
+                                              const uint32_t *, unsigned *,
+                                              void *);
+      unsigned error;
+
+      if (dri2_dpy->image_driver)
+         create_context_attribs = dri2_dpy->image_driver->createContextAttribs;
+      else if (dri2_dpy->dri2)
+         create_context_attribs = dri2_dpy->dri2->createContextAttribs;
+      else
+         create_context_attribs = dri2_dpy->swrast->createContextAttribs;
+
+      dri2_ctx->dri_context =
+         create_context_attribs(dri2_dpy->dri_screen,
+                                dri2_ctx->api,
+                                dri2_ctx->dri_config,
+                                shared,
+                                dri2_ctx->num_attribs / 2,
+                                dri2_ctx->ctx_attribs,
+                                & error,
+                                dri2_ctx);
+      dri2_create_context_attribs_error(error);
+   } else if (dri2_dpy->dri2) {
+      dri2_ctx->dri_context =
+         dri2_dpy->dri2->createNewContextForAPI(dri2_dpy->dri_screen,
+                                                dri2_ctx->api,
+                                                dri2_ctx->dri_config,
+                                                shared,
+                                                dri2_ctx);
+   } else {
+      dri2_ctx->dri_context =
+         dri2_dpy->swrast->createNewContextForAPI(dri2_dpy->dri_screen,
+                                                  dri2_ctx->api,
+                                                  dri2_ctx->dri_config,
+                                                  shared,
+                                                  dri2_ctx);
+   }
+
+   if (!dri2_ctx->dri_context) {
+      /* createContextAttribs already reported why */
+      if (!dri2_has_create_context_attribs(dri2_dpy))
+         _eglError(EGL_BAD_ALLOC, "dri2_create_context");
+      return EGL_FALSE;
+   }
+
+   /* The driver keeps the share group alive from here on. */
+   if (dri2_ctx->shared) {
+      dri2_destroy_context(drv, disp, dri2_ctx->shared);
+      dri2_ctx->shared = NULL;
+   }
+
+   return EGL_TRUE;
+}
+
 /**
  * Called via eglCreateContext(), drv->API.CreateContext().
  */
@@ -1075,15 +1239,10 @@ dri2_create_context(_EGLDriver *drv, _EGLDisplay *disp, _EGLConfig *conf,
 {
    struct dri2_egl_context *dri2_ctx;
    struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
-   struct dri2_egl_context *dri2_ctx_shared = dri2_egl_context(share_list);
-   __DRIcontext *shared =
-      dri2_ctx_shared ? dri2_ctx_shared->dri_context : NULL;
    struct dri2_egl_config *dri2_config = dri2_egl_config(conf);
    const __DRIconfig *dri_config;
    int api;
 
-   (void) drv;
-
    dri2_ctx = malloc(sizeof *dri2_ctx);
    if (!dri2_ctx) {
       _eglError(EGL_BAD_ALLOC, "eglCreateContext");
@@ -1162,86 +1321,31 @@ dri2_create_context(_EGLDriver *drv, _EGLDisplay *disp, _EGLConfig *conf,
    else
       dri_config = NULL;
 
-   if (dri2_dpy->image_driver) {
-      unsigned error;
-      unsigned num_attribs = 8;
-      uint32_t ctx_attribs[8];
+   dri2_ctx->dri_context = NULL;
+   dri2_ctx->api = api;
+   dri2_ctx->dri_config = dri_config;
+   dri2_ctx->num_attribs = 0;
 
-      if (!dri2_fill_context_attribs(dri2_ctx, dri2_dpy, ctx_attribs,
-                                        &num_attribs))
+   if (dri2_has_create_context_attribs(dri2_dpy)) {
+      dri2_ctx->num_attribs = ARRAY_SIZE(dri2_ctx->ctx_attribs);
+      if (!dri2_fill_context_attribs(dri2_ctx, dri2_dpy, dri2_ctx->ctx_attribs,
+                                     &dri2_ctx->num_attribs))
          goto cleanup;
-
-      dri2_ctx->dri_context =
-         dri2_dpy->image_driver->createContextAttribs(dri2_dpy->dri_screen,
-                                                      api,
-                                                      dri_config,
-                                                      shared,
-                                                      num_attribs / 2,
-                                                      ctx_attribs,
-                                                      & error,
-                                                      dri2_ctx);
-      dri2_create_context_attribs_error(error);
-   } else if (dri2_dpy->dri2) {
-      if (dri2_dpy->dri2->base.version >= 3) {
-         unsigned error;
-         unsigned num_attribs = 8;
-         uint32_t ctx_attribs[8];
-
-         if (!dri2_fill_context_attribs(dri2_ctx, dri2_dpy, ctx_attribs,
-                                        &num_attribs))
-            goto cleanup;
-
-         dri2_ctx->dri_context =
-            dri2_dpy->dri2->createContextAttribs(dri2_dpy->dri_screen,
-                                                 api,
-                                                 dri_config,
-                                                 shared,
-                                                 num_attribs / 2,
-                                                 ctx_attribs,
-                                                 & error,
-                                                 dri2_ctx);
-         dri2_create_context_attribs_error(error);
-      } else {
-         dri2_ctx->dri_context =
-            dri2_dpy->dri2->createNewContextForAPI(dri2_dpy->dri_screen,
-                                                   api,
-                                                   dri_config,
-                                                   shared,
-                                                   dri2_ctx);
-      }
-   } else {
-      assert(dri2_dpy->swrast);
-      if (dri2_dpy->swrast->base.version >= 3) {
-         unsigned error;
-         unsigned num_attribs = 8;
-         uint32_t ctx_attribs[8];
-
-         if (!dri2_fill_context_attribs(dri2_ctx, dri2_dpy, ctx_attribs,
-                                        &num_attribs))
-            goto cleanup;
-
-         dri2_ctx->dri_context =
-            dri2_dpy->swrast->createContextAttribs(dri2_dpy->dri_screen,
-                                                   api,
-                                                   dri_config,
-                                                   shared,
-                                                   num_attribs / 2,
-                                                   ctx_attribs,
-                                                   & error,
-                                                   dri2_ctx);
-         dri2_create_context_attribs_error(error);
-      } else {
-         dri2_ctx->dri_context =
-            dri2_dpy->swrast->createNewContextForAPI(dri2_dpy->dri_screen,
-                                                     api,
-                                                     dri_config,
-                                                     shared,
-                                                     dri2_ctx);
-      }
    }
 
-   if (!dri2_ctx->dri_context)
+   /* Hold the share context until our __DRIcontext joins its share group. */
+   dri2_ctx->shared = _eglGetContext(share_list);
+
+   /* Everything that can fail validation has been checked; a lazy context
+    * only allocates the driver state once it is made current.
+    */
+   if (dri2_dpy->lazy_context)
+      return &dri2_ctx->base;
+
+   if (!dri2_realize_context(drv, disp, dri2_ctx)) {
+      _eglPutContext(share_list);
       goto cleanup;
+   }
 
    return &dri2_ctx->base;
 
@@ -1260,7 +1364,10 @@ dri2_destroy_context(_EGLDriver *drv, _EGLDisplay *disp, _EGLContext *ctx)
    struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
 
    if (_eglPutContext(ctx)) {
-      dri2_dpy->core->destroyContext(dri2_ctx->dri_context);
+      if (dri2_ctx->dri_context)
+         dri2_dpy->core->destroyContext(dri2_ctx->dri_context);
+      if (dri2_ctx->shared)
+         dri2_destroy_context(drv, disp, dri2_ctx->shared);
       free(dri2_ctx);
    }
 
@@ -1298,6 +1405,20 @@ dri2_make_current(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *dsurf,
    if (!dri2_dpy)
       return _eglError(EGL_NOT_INITIALIZED, "eglMakeCurrent");
 
+   /* Lazy contexts get their driver state on first bind.  Failures here
+    * carry the error eglCreateContext would have reported.
+    */
+   if (dri2_ctx && !dri2_realize_context(drv, disp, dri2_ctx))
+      return EGL_FALSE;
+
+   /* Platforms may create drawables on first use; that can fail, and must
+    * do so before any binding changes.
+    */
+   ddraw = (dsurf) ? dri2_dpy->vtbl->get_dri_drawable(dsurf) : NULL;
+   rdraw = (rsurf) ? dri2_dpy->vtbl->get_dri_drawable(rsurf) : NULL;
+   if ((dsurf && !ddraw) || (rsurf && !rdraw))
+      return EGL_FALSE;
+
    /* make new bindings */
    if (!_eglBindContext(ctx, dsurf, rsurf, &old_ctx, &old_dsurf, &old_rsurf)) {
       /* _eglBindContext already sets the EGL error (in _eglCheckMakeCurrent) */
@@ -1308,8 +1429,6 @@ dri2_make_current(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *dsurf,
    if (old_ctx)
       dri2_drv->glFlush();
 
-   ddraw = (dsurf) ? dri2_dpy->vtbl->get_dri_drawable(dsurf) : NULL;
-   rdraw = (rsurf) ? dri2_dpy->vtbl->get_dri_drawable(rsurf) : NULL;
    cctx = (dri2_ctx) ? dri2_ctx->dri_context : NULL;
 
    if (old_ctx) {
@@ -1471,6 +1590,16 @@ dri2_swap_buffers_region(_EGLDriver *drv, _EGLDisplay *dpy, _EGLSurface *surf,
    return dri2_dpy->vtbl->swap_buffers_region(drv, dpy, surf, numRects, rects);
 }
 
+static EGLBoolean
+dri2_swap_buffers_multi(_EGLDriver *drv, _EGLDisplay *dpy, EGLint n_surfaces,
+                        _EGLSurface **surfaces, const EGLint *const *rects,
+                        const EGLint *n_rects)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dpy);
+   return dri2_dpy->vtbl->swap_buffers_multi(drv, dpy, n_surfaces, surfaces,
+                                             rects, n_rects);
+}
+
 static EGLBoolean
 dri2_post_sub_buffer(_EGLDriver *drv, _EGLDisplay *dpy, _EGLSurface *surf,
                      EGLint x, EGLint y, EGLint width, EGLint height)
@@ -1487,6 +1616,14 @@ dri2_copy_buffers(_EGLDriver *drv, _EGLDisplay *dpy, _EGLSurface *surf,
    return dri2_dpy->vtbl->copy_buffers(drv, dpy, surf, native_pixmap_target);
 }
 
+static EGLBoolean
+dri2_set_damage_region(_EGLDriver *drv, _EGLDisplay *dpy, _EGLSurface *surf,
+                       EGLint *rects, EGLint n_rects)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dpy);
+   return dri2_dpy->vtbl->set_damage_region(drv, dpy, surf, rects, n_rects);
+}
+
 static EGLint
 dri2_query_buffer_age(_EGLDriver *drv, _EGLDisplay *dpy, _EGLSurface *surf)
 {
@@ -1654,6 +1791,11 @@ dri2_create_image_khr_renderbuffer(_EGLDisplay *disp, _EGLContext *ctx,
       return EGL_NO_IMAGE_KHR;
    }
 
+   /* a lazy context may never have been current; realizing it reports
+    * the same error eglCreateContext would have */
+   if (!dri2_realize_context(disp->Driver, disp, dri2_ctx))
+      return EGL_NO_IMAGE_KHR;
+
    dri_image =
       dri2_dpy->image->createImageFromRenderbuffer(dri2_ctx->dri_context,
                                                    renderbuffer, NULL);
@@ -1794,6 +1936,11 @@ dri2_create_image_khr_texture(_EGLDisplay *disp, _EGLContext *ctx,
    if (_eglParseImageAttribList(&attrs, disp, attr_list) != EGL_SUCCESS)
       return EGL_NO_IMAGE_KHR;
 
+   /* a lazy context may never have been current; realizing it reports
+    * the same error eglCreateContext would have */
+   if (!dri2_realize_context(disp->Driver, disp, dri2_ctx))
+      return EGL_NO_IMAGE_KHR;
+
    switch (target) {
    case EGL_GL_TEXTURE_2D_KHR:
       depth = 0;
@@ -2802,6 +2949,9 @@ dri2_interop_query_device_info(_EGLDisplay *dpy, _EGLContext *ctx,
    if (!dri2_dpy->interop)
       return MESA_GLINTEROP_UNSUPPORTED;
 
+   if (!dri2_realize_context(dpy->Driver, dpy, dri2_ctx))
+      return MESA_GLINTEROP_INVALID_CONTEXT;
+
    return dri2_dpy->interop->query_device_info(dri2_ctx->dri_context, out);
 }
 
@@ -2816,6 +2966,9 @@ dri2_interop_export_object(_EGLDisplay *dpy, _EGLContext *ctx,
    if (!dri2_dpy->interop)
       return MESA_GLINTEROP_UNSUPPORTED;
 
+   if (!dri2_realize_context(dpy->Driver, dpy, dri2_ctx))
+      return MESA_GLINTEROP_INVALID_CONTEXT;
+
    return dri2_dpy->interop->export_object(dri2_ctx->dri_context, in, out);
 }
 
@@ -2901,6 +3054,8 @@ _eglBuiltInDriverDRI2(const char *args)
    _eglInitDriverFallbacks(&dri2_drv->base);
    dri2_drv->base.API.Initialize = dri2_initialize;
    dri2_drv->base.API.Terminate = dri2_terminate;
+   dri2_drv->base.API.GetConfigs = dri2_get_configs;
+   dri2_drv->base.API.ChooseConfig = dri2_choose_config;
    dri2_drv->base.API.CreateContext = dri2_create_context;
    dri2_drv->base.API.DestroyContext = dri2_destroy_context;
    dri2_drv->base.API.MakeCurrent = dri2_make_current;
@@ -2917,9 +3072,11 @@ _eglBuiltInDriverDRI2(const char *args)
    dri2_drv->base.API.SwapBuffers = dri2_swap_buffers;
    dri2_drv->base.API.SwapBuffersWithDamageEXT = dri2_swap_buffers_with_damage;
    dri2_drv->base.API.SwapBuffersRegionNOK = dri2_swap_buffers_region;
+   dri2_drv->base.API.SwapBuffersMultiMESA = dri2_swap_buffers_multi;
    dri2_drv->base.API.PostSubBufferNV = dri2_post_sub_buffer;
    dri2_drv->base.API.CopyBuffers = dri2_copy_buffers,
    dri2_drv->base.API.QueryBufferAge = dri2_query_buffer_age;
+   dri2_drv->base.API.SetDamageRegion = dri2_set_damage_region;
    dri2_drv->base.API.CreateImageKHR = dri2_create_image;
    dri2_drv->base.API.DestroyImageKHR = dri2_destroy_image_khr;
    dri2_drv->base.API.CreateWaylandBufferFromImageWL = dri2_create_wayland_buffer_from_image;
@@ -28,12 +28,15 @@
 #ifndef EGL_DRI2_INCLUDED
 #define EGL_DRI2_INCLUDED
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef HAVE_X11_PLATFORM
 #include <xcb/xcb.h>
 #include <xcb/dri2.h>
 #include <xcb/xfixes.h>
+#include <xcb/shm.h>
+#include <xcb/present.h>
 #include <X11/Xlib-xcb.h>
 
 #ifdef HAVE_DRI3
@@ -94,6 +97,8 @@ struct dri2_egl_driver
 struct dri2_egl_display_vtbl {
    int (*authenticate)(_EGLDisplay *disp, uint32_t id);
 
+   EGLBoolean (*add_configs)(_EGLDriver *drv, _EGLDisplay *dpy);
+
    _EGLSurface* (*create_window_surface)(_EGLDriver *drv, _EGLDisplay *dpy,
                                          _EGLConfig *config,
                                          void *native_window,
@@ -130,6 +135,11 @@ struct dri2_egl_display_vtbl {
                                      _EGLSurface *surf, EGLint numRects,
                                      const EGLint *rects);
 
+   EGLBoolean (*swap_buffers_multi)(_EGLDriver *drv, _EGLDisplay *dpy,
+                                    EGLint n_surfaces, _EGLSurface **surfaces,
+                                    const EGLint *const *rects,
+                                    const EGLint *n_rects);
+
    EGLBoolean (*post_sub_buffer)(_EGLDriver *drv, _EGLDisplay *dpy,
                                  _EGLSurface *surf,
                                  EGLint x, EGLint y,
@@ -141,6 +151,10 @@ struct dri2_egl_display_vtbl {
    EGLint (*query_buffer_age)(_EGLDriver *drv, _EGLDisplay *dpy,
                               _EGLSurface *surf);
 
+   EGLBoolean (*set_damage_region)(_EGLDriver *drv, _EGLDisplay *dpy,
+                                   _EGLSurface *surf,
+                                   const EGLint *rects, EGLint n_rects);
+
    EGLBoolean (*query_surface)(_EGLDriver *drv, _EGLDisplay *dpy,
                                _EGLSurface *surf, EGLint attribute,
                                EGLint *value);
@@ -177,6 +191,10 @@ struct dri2_egl_display
    const __DRI2fenceExtension *fence;   //NULL
    const __DRI2rendererQueryExtension *rendererQuery;
    const __DRI2interopExtension *interop;
+   const __DRIcopySubBufferExtension *copy_sub_buffer;
+#ifdef __DRI2_DAMAGE
+   const __DRI2damageExtension *damage;
+#endif
    int                       fd;
 
    /* dri2_initialize/dri2_terminate increment/decrement this count, so does
@@ -188,6 +206,16 @@ struct dri2_egl_display
    int                       min_swap_interval;
    int                       max_swap_interval;
    int                       default_swap_interval;
+
+   /* Platforms that build their EGLConfigs lazily set this instead of
+    * populating disp->Configs in eglInitialize; vtbl->add_configs runs on
+    * the first eglGetConfigs/eglChooseConfig. */
+   bool                      configs_deferred;
+
+   /* EGL_LAZY_CONTEXT: create __DRIcontexts on first eglMakeCurrent, or
+    * on the first EGLImage or interop call needing one; driver errors are
+    * reported there rather than by eglCreateContext */
+   int                       lazy_context;
 #ifdef HAVE_DRM_PLATFORM
    struct gbm_dri_device    *gbm_dri;
 #endif
@@ -201,6 +229,16 @@ struct dri2_egl_display
    xcb_connection_t         *conn;
    int                      screen;
    int                      swap_available;
+   int                      has_shm;    /* MIT-SHM usable (local server) */
+   int                      has_present;
+   int                      tile_damage; /* EGL_SWRAST_TILE_DAMAGE */
+   int                      async_present; /* EGL_SWRAST_ASYNC_PRESENT */
+   int                      conn_thread_safe; /* xcb, or Xlib after XInitThreads */
+   int                      present_swap; /* EGL_SWRAST_PRESENT, needs SHM */
+   /* EGL_SYNC_VALUES_MAX_AGE, in microseconds; 0 always asks the server */
+   int64_t                  sync_values_max_age;
+   /* set when DRI2 invalidate events are delivered to the driver */
+   struct dri2_x11_invalidate_hook *invalidate_hook;
 #ifdef HAVE_DRI3
    struct loader_dri3_extensions loader_dri3_ext;
 #endif
@@ -226,7 +264,14 @@ struct dri2_egl_display
 struct dri2_egl_context
 {
    _EGLContext   base;
-   __DRIcontext *dri_context;
+   __DRIcontext *dri_context;   /* NULL until realized for lazy contexts */
+
+   /* validated creation parameters, see dri2_realize_context() */
+   int                api;
+   const __DRIconfig *dri_config;
+   _EGLContext       *shared;
+   uint32_t           ctx_attribs[8];
+   unsigned           num_attribs;
 };
 
 #ifdef HAVE_WAYLAND_PLATFORM
@@ -248,11 +293,106 @@ struct dri2_egl_surface
 
 #ifdef HAVE_X11_PLATFORM
    xcb_drawable_t       drawable;
-   xcb_xfixes_region_t  region;
+   const __DRIconfig   *dri_config;   /* for deferred drawable creation */
+   int                  requests_pending;
+   xcb_void_cookie_t    create_cookie;
+   xcb_get_geometry_cookie_t geometry_cookie;
+   xcb_get_window_attributes_cookie_t attributes_cookie;
+   xcb_xfixes_region_t  region;   /* whole surface, for CopyRegion swaps */
+   int                  region_width;
+   int                  region_height;
+   /* scratch region and rectangles for eglSwapBuffersRegionNOK */
+   xcb_xfixes_region_t  swap_region;
+   xcb_rectangle_t     *swap_rects;
+   int                  swap_rects_size;
+   /* on the list of drawables DRI2 invalidate events are delivered to */
+   int                  invalidate_watched;
+   struct dri2_egl_surface *invalidate_next;
+   /* DRI2 SwapBuffers whose reply has not been collected yet */
+   xcb_dri2_swap_buffers_cookie_t swap_cookie;
+   int                  swap_pending;
    int                  depth;
    int                  bytes_per_pixel;
    xcb_gcontext_t       gc;
    xcb_gcontext_t       swapgc;
+   /* DRI2 only, for eglCopyBuffers; swrast uses swapgc */
+   xcb_gcontext_t       copy_gc;
+
+   /* swrast MIT-SHM staging segment, shmid == -1 when not allocated */
+   int                  shmid;
+   xcb_shm_seg_t        shmseg;
+   void                *shm_addr;
+   size_t               shm_size;
+   int                  shm_busy;   /* server may still be reading shm_addr */
+   bool                 shm_batch;  /* packing a frame's blocks at shm_offset */
+   size_t               shm_offset;
+   xcb_get_input_focus_cookie_t shm_fence;
+
+   /* driver owned segment attached for putImageShm/getImageShm */
+   int                  dri_shmid;
+   xcb_shm_seg_t        dri_shmseg;
+
+   /* swrast: base.Width/Height are trusted while geometry_valid is set;
+    * Present ConfigureNotify events keep them current for windows. */
+   int                  geometry_valid;
+   xcb_present_event_t  eid;
+   /* checked SelectInput, collected after the first GetGeometry reply */
+   xcb_void_cookie_t    present_select_cookie;
+   bool                 present_select_pending;
+   xcb_special_event_t *special_event;
+   uint32_t             stamp;
+
+   /* swrast: back buffer size at the last swap, 0x0 before the first one */
+   int                  swap_width;
+   int                  swap_height;
+
+   /* swrast: eglSetDamageRegionKHR rects for the frame being drawn */
+   EGLint              *damage_rects;
+   EGLint               n_damage_rects;
+
+   /* swrast tile damage: set when the drawable keeps its contents, hash
+    * per tile of the frame on screen (0 when unknown), the frame size
+    * they were taken at and scratch space for the dirty rectangles */
+   int                  tile_damage;
+   uint64_t            *tile_hashes;
+   int                  tile_cols;
+   int                  tile_rows;
+   int                  tile_width;
+   int                  tile_height;
+   xcb_rectangle_t     *tile_rects;
+
+   /* swrast: pixel layout the driver renders in and the one the server
+    * expects for the drawable's depth (SWRAST_FORMAT_*), plus scratch
+    * space for converting uploads that cannot go through shared memory */
+   int                  dri_format;
+   int                  server_format;
+   int                  server_bytes_per_pixel;
+   int                  scanline_pad;    /* in bytes */
+   void                *convert_buf;
+   size_t               convert_size;
+
+   /* swrast: thread sending swapped frames, NULL when presenting inline */
+   struct swrast_presenter *presenter;
+
+   /* swrast: SHM pixmaps handed to PresentPixmap, NULL when swaps use
+    * PutImage; sbc counts sent swaps, the rest the last completed one */
+   struct swrast_present_buffer *present_buffers;
+   uint64_t             present_sbc;
+   uint64_t             complete_sbc;
+   uint64_t             complete_msc;
+   uint64_t             complete_ust;
+
+   /* DRI2: the last GetMSC reply (ust 0 when there is none), the refresh
+    * period measured between replies, the values last handed out by
+    * eglGetSyncValuesCHROMIUM and the sbc of the last swap sent */
+   int64_t              sync_ust;
+   int64_t              sync_msc;
+   int64_t              sync_sbc;
+   int64_t              sync_period;
+   int64_t              sync_ret_ust;
+   int64_t              sync_ret_msc;
+   int64_t              sync_ret_sbc;
+   int64_t              swap_sbc;
 #endif
 
 #ifdef HAVE_WAYLAND_PLATFORM
@@ -376,6 +516,9 @@ dri2_create_image_dma_buf(_EGLDisplay *disp, _EGLContext *ctx,
 EGLBoolean
 dri2_initialize_x11(_EGLDriver *drv, _EGLDisplay *disp);
 
+void
+dri2_teardown_x11(struct dri2_egl_display *dri2_dpy);
+
 EGLBoolean
 dri2_initialize_drm(_EGLDriver *drv, _EGLDisplay *disp);
 
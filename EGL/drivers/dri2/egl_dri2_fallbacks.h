@@ -78,6 +78,34 @@ dri2_fallback_swap_buffers_region(_EGLDriver *drv, _EGLDisplay *dpy,
    return EGL_FALSE;
 }
 
+static inline EGLBoolean
+dri2_fallback_swap_buffers_multi(_EGLDriver *drv, _EGLDisplay *dpy,
+                                 EGLint n_surfaces, _EGLSurface **surfaces,
+                                 const EGLint *const *rects,
+                                 const EGLint *n_rects)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dpy);
+   EGLBoolean ret = EGL_TRUE;
+   EGLint i;
+
+   for (i = 0; i < n_surfaces; i++) {
+      EGLBoolean swapped;
+
+      if (n_rects && n_rects[i] > 0)
+         swapped = dri2_dpy->vtbl->swap_buffers_with_damage(drv, dpy,
+                                                            surfaces[i],
+                                                            rects[i],
+                                                            n_rects[i]);
+      else
+         swapped = dri2_dpy->vtbl->swap_buffers(drv, dpy, surfaces[i]);
+
+      if (!swapped)
+         ret = EGL_FALSE;
+   }
+
+   return ret;
+}
+
 static inline EGLBoolean
 dri2_fallback_post_sub_buffer(_EGLDriver *drv, _EGLDisplay *dpy,
                               _EGLSurface *draw,
@@ -101,6 +129,14 @@ dri2_fallback_query_buffer_age(_EGLDriver *drv, _EGLDisplay *dpy,
    return 0;
 }
 
+static inline EGLBoolean
+dri2_fallback_set_damage_region(_EGLDriver *drv, _EGLDisplay *dpy,
+                                _EGLSurface *surf,
+                                const EGLint *rects, EGLint n_rects)
+{
+   return EGL_FALSE;
+}
+
 static inline struct wl_buffer*
 dri2_fallback_create_wayland_buffer_from_image(_EGLDriver *drv,
                                                _EGLDisplay *dpy,
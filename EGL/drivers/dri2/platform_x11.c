@@ -31,6 +31,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
+#include <time.h>
 #include <dlfcn.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -40,6 +41,10 @@
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlibint.h>
+#include <xcb/xcbext.h>
 
 #include "egl_dri2.h"
 #include "egl_dri2_fallbacks.h"
@@ -53,6 +58,123 @@ static EGLBoolean
 dri2_x11_swap_interval(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *surf,
                        EGLint interval);
 
+static void
+swrastPresenterStart(struct dri2_egl_display *dri2_dpy,
+                     struct dri2_egl_surface *dri2_surf);
+static void
+swrastPresenterStop(struct dri2_egl_surface *dri2_surf);
+static void
+swrastPresentBuffersFree(struct dri2_egl_display *dri2_dpy,
+                         struct dri2_egl_surface *dri2_surf);
+static void
+dri2_x11_setup_swap_interval(struct dri2_egl_display *dri2_dpy);
+
+/* Pixel layouts swrast knows how to convert between. Packed formats are
+ * little endian words, most significant channel first in the name.
+ */
+enum swrast_format {
+   SWRAST_FORMAT_NONE = 0,
+   SWRAST_FORMAT_RGB565,
+   SWRAST_FORMAT_RGB888,        /* 24 bits per pixel */
+   SWRAST_FORMAT_XRGB8888,
+   SWRAST_FORMAT_ARGB8888,
+   SWRAST_FORMAT_XRGB2101010,
+   SWRAST_FORMAT_ARGB2101010,
+};
+
+/**
+ * Layout the driver renders in, derived from the surface's config.
+ */
+static enum swrast_format
+swrastConfigFormat(const _EGLConfig *conf)
+{
+   EGLint red = _eglGetConfigKey(conf, EGL_RED_SIZE);
+   EGLint alpha = _eglGetConfigKey(conf, EGL_ALPHA_SIZE);
+
+   switch (_eglGetConfigKey(conf, EGL_BUFFER_SIZE)) {
+   case 16:
+      return red == 5 ? SWRAST_FORMAT_RGB565 : SWRAST_FORMAT_NONE;
+   case 24:
+      return red == 8 ? SWRAST_FORMAT_XRGB8888 : SWRAST_FORMAT_NONE;
+   case 32:
+      if (red == 10)
+         return alpha ? SWRAST_FORMAT_ARGB2101010 : SWRAST_FORMAT_XRGB2101010;
+      if (red == 8)
+         return alpha ? SWRAST_FORMAT_ARGB8888 : SWRAST_FORMAT_XRGB8888;
+      return SWRAST_FORMAT_NONE;
+   default:
+      return SWRAST_FORMAT_NONE;
+   }
+}
+
+/**
+ * Layout of Z pixmap images of the given depth on this connection, or
+ * SWRAST_FORMAT_NONE when the server's byte order differs from ours.
+ */
+static enum swrast_format
+swrastServerFormat(const xcb_setup_t *setup, int depth, int *bpp, int *pad)
+{
+   static const uint16_t one = 1;
+   xcb_format_iterator_t iter;
+   int lsb_first = *(const uint8_t *) &one;
+
+   *bpp = 0;
+   *pad = 4;
+   for (iter = xcb_setup_pixmap_formats_iterator(setup); iter.rem;
+        xcb_format_next(&iter)) {
+      if (iter.data->depth == depth) {
+         *bpp = iter.data->bits_per_pixel;
+         *pad = iter.data->scanline_pad / 8;
+         break;
+      }
+   }
+
+   if ((setup->image_byte_order == XCB_IMAGE_ORDER_LSB_FIRST) != lsb_first)
+      return SWRAST_FORMAT_NONE;
+
+   switch (depth) {
+   case 16:
+      return *bpp == 16 ? SWRAST_FORMAT_RGB565 : SWRAST_FORMAT_NONE;
+   case 24:
+      if (*bpp == 24)
+         return lsb_first ? SWRAST_FORMAT_RGB888 : SWRAST_FORMAT_NONE;
+      return *bpp == 32 ? SWRAST_FORMAT_XRGB8888 : SWRAST_FORMAT_NONE;
+   case 30:
+      return *bpp == 32 ? SWRAST_FORMAT_XRGB2101010 : SWRAST_FORMAT_NONE;
+   case 32:
+      return *bpp == 32 ? SWRAST_FORMAT_ARGB8888 : SWRAST_FORMAT_NONE;
+   default:
+      return SWRAST_FORMAT_NONE;
+   }
+}
+
+/* SHM pixmaps a window cycles through with PresentPixmap */
+#define SWRAST_PRESENT_BUFFERS 3
+
+struct swrast_present_buffer {
+   xcb_pixmap_t pixmap;     /* 0 when not allocated */
+   xcb_shm_seg_t shmseg;
+   void *addr;
+   int width;
+   int height;
+   int stride;
+   bool busy;               /* the server owns it until PresentIdleNotify */
+};
+
+/**
+ * Whether a window that swaps with PutImage gets a presenter thread.
+ * Mailbox windows want the queue so that a frame can be replaced before it
+ * is sent, but only where the thread may share the connection; otherwise
+ * swaps stay synchronous, so no frame ever waits to be replaced.
+ */
+static bool
+swrastWantsPresenter(const struct dri2_egl_display * dri2_dpy,
+                     const struct dri2_egl_surface * dri2_surf)
+{
+   return dri2_dpy->async_present ||
+          (dri2_surf->base.PresentMailbox && dri2_dpy->conn_thread_safe);
+}
+
 static void
 swrastCreateDrawable(struct dri2_egl_display * dri2_dpy,
                      struct dri2_egl_surface * dri2_surf)
@@ -71,8 +193,69 @@ swrastCreateDrawable(struct dri2_egl_display * dri2_dpy,
    valgc[0] = function;
    valgc[1] = False;
    xcb_create_gc(dri2_dpy->conn, dri2_surf->swapgc, dri2_surf->drawable, mask, valgc);
+
+   /* Pixmaps and pbuffers cannot change size. Windows can, so ask Present
+    * to report it on our own queue instead of querying every frame; the
+    * first query after selecting the events still does a round trip, and
+    * that is where swrastCheckPresentSelect collects the error, if any.
+    */
+   dri2_surf->special_event = NULL;
+   dri2_surf->present_buffers = NULL;
+   dri2_surf->present_select_pending = false;
+   dri2_surf->geometry_valid = dri2_surf->base.Type != EGL_WINDOW_BIT;
+   if (dri2_surf->base.Type == EGL_WINDOW_BIT && dri2_dpy->has_present) {
+      mask = XCB_PRESENT_EVENT_MASK_CONFIGURE_NOTIFY;
+      if (dri2_dpy->present_swap)
+         mask |= XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY |
+                 XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY;
+
+      dri2_surf->eid = xcb_generate_id(dri2_dpy->conn);
+      dri2_surf->present_select_cookie =
+         xcb_present_select_input_checked(dri2_dpy->conn, dri2_surf->eid,
+                                          dri2_surf->drawable, mask);
+      dri2_surf->present_select_pending = true;
+      dri2_surf->special_event =
+         xcb_register_for_special_xge(dri2_dpy->conn, &xcb_present_id,
+                                      dri2_surf->eid, &dri2_surf->stamp);
+   }
+
+   /* Present already leaves the copy out of the render thread, so the
+    * presenter thread is only used for PutImage swaps.
+    */
+   if (dri2_surf->special_event && dri2_dpy->present_swap)
+      dri2_surf->present_buffers = calloc(SWRAST_PRESENT_BUFFERS,
+                                          sizeof(*dri2_surf->present_buffers));
+
+   dri2_surf->presenter = NULL;
+   if (dri2_surf->base.Type == EGL_WINDOW_BIT && !dri2_surf->present_buffers &&
+       swrastWantsPresenter(dri2_dpy, dri2_surf))
+      swrastPresenterStart(dri2_dpy, dri2_surf);
+
+   dri2_surf->dri_format = swrastConfigFormat(dri2_surf->base.Config);
+   dri2_surf->server_format =
+      swrastServerFormat(xcb_get_setup(dri2_dpy->conn), dri2_surf->depth,
+                         &dri2_surf->server_bytes_per_pixel,
+                         &dri2_surf->scanline_pad);
+   dri2_surf->server_bytes_per_pixel /= 8;
+
+   /* bytes_per_pixel describes the driver's buffers; when the layouts
+    * differ swrastXPutImage/swrastXGetImage convert to and from the
+    * server's.
+    */
+   switch (dri2_surf->dri_format) {
+      case SWRAST_FORMAT_RGB565:
+         dri2_surf->bytes_per_pixel = 2;
+         return;
+      case SWRAST_FORMAT_NONE:
+         break;
+      default:
+         dri2_surf->bytes_per_pixel = 4;
+         return;
+   }
+
    switch (dri2_surf->depth) {
       case 32:
+      case 30:
       case 24:
          dri2_surf->bytes_per_pixel = 4;
          break;
@@ -90,108 +273,1888 @@ swrastCreateDrawable(struct dri2_egl_display * dri2_dpy,
    }
 }
 
+/**
+ * Wait until the server has consumed the last ShmPutImage from the surface's
+ * segment, so it can be overwritten or detached.
+ */
+static void
+swrastShmWait(struct dri2_egl_display * dri2_dpy,
+              struct dri2_egl_surface * dri2_surf)
+{
+   if (!dri2_surf->shm_busy)
+      return;
+
+   free(xcb_get_input_focus_reply(dri2_dpy->conn, dri2_surf->shm_fence, NULL));
+   dri2_surf->shm_busy = false;
+}
+
+/**
+ * Collect the result of the Present SelectInput sent by swrastCreateDrawable.
+ * Called once a later reply has arrived, so it never waits on the server.
+ * If it failed the window goes back to GetGeometry per frame and PutImage.
+ */
+static void
+swrastCheckPresentSelect(struct dri2_egl_display * dri2_dpy,
+                         struct dri2_egl_surface * dri2_surf)
+{
+   xcb_generic_error_t *error;
+
+   if (!dri2_surf->present_select_pending)
+      return;
+
+   dri2_surf->present_select_pending = false;
+   error = xcb_request_check(dri2_dpy->conn, dri2_surf->present_select_cookie);
+   if (!error)
+      return;
+
+   free(error);
+   xcb_unregister_for_special_event(dri2_dpy->conn, dri2_surf->special_event);
+   dri2_surf->special_event = NULL;
+   swrastPresentBuffersFree(dri2_dpy, dri2_surf);
+
+   if (!dri2_surf->presenter && swrastWantsPresenter(dri2_dpy, dri2_surf))
+      swrastPresenterStart(dri2_dpy, dri2_surf);
+}
+
+static void
+swrastShmRelease(struct dri2_egl_display * dri2_dpy,
+                 struct dri2_egl_surface * dri2_surf)
+{
+   if (dri2_surf->shmid == -1)
+      return;
+
+   swrastShmWait(dri2_dpy, dri2_surf);
+   xcb_shm_detach(dri2_dpy->conn, dri2_surf->shmseg);
+   shmdt(dri2_surf->shm_addr);
+
+   dri2_surf->shmid = -1;
+   dri2_surf->shm_addr = NULL;
+   dri2_surf->shm_size = 0;
+}
+
+/**
+ * Make sure the surface has an attached SHM segment of at least size bytes.
+ *
+ * The segment is marked for removal as soon as the server has attached it,
+ * so it cannot leak if we crash.
+ */
+static bool
+swrastShmReserve(struct dri2_egl_display * dri2_dpy,
+                 struct dri2_egl_surface * dri2_surf, size_t size)
+{
+   xcb_void_cookie_t cookie;
+   xcb_generic_error_t *error;
+   void *addr;
+   int id;
+
+   if (dri2_surf->shmid != -1 && dri2_surf->shm_size >= size)
+      return true;
+
+   swrastShmRelease(dri2_dpy, dri2_surf);
+
+   id = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+   if (id == -1)
+      return false;
+
+   addr = shmat(id, NULL, 0);
+   if (addr == (void *) -1) {
+      shmctl(id, IPC_RMID, NULL);
+      return false;
+   }
+
+   dri2_surf->shmseg = xcb_generate_id(dri2_dpy->conn);
+   cookie = xcb_shm_attach_checked(dri2_dpy->conn, dri2_surf->shmseg, id,
+                                   false);
+   error = xcb_request_check(dri2_dpy->conn, cookie);
+   shmctl(id, IPC_RMID, NULL);
+   if (error) {
+      free(error);
+      shmdt(addr);
+      return false;
+   }
+
+   dri2_surf->shmid = id;
+   dri2_surf->shm_addr = addr;
+   dri2_surf->shm_size = size;
+
+   return true;
+}
+
 static void
 swrastDestroyDrawable(struct dri2_egl_display * dri2_dpy,
                       struct dri2_egl_surface * dri2_surf)
 {
+   swrastPresenterStop(dri2_surf);
+   swrastPresentBuffersFree(dri2_dpy, dri2_surf);
+   swrastShmRelease(dri2_dpy, dri2_surf);
+   if (dri2_surf->present_select_pending) {
+      xcb_discard_reply(dri2_dpy->conn,
+                        dri2_surf->present_select_cookie.sequence);
+      dri2_surf->present_select_pending = false;
+   }
+   if (dri2_surf->dri_shmid != -1) {
+      xcb_shm_detach(dri2_dpy->conn, dri2_surf->dri_shmseg);
+      dri2_surf->dri_shmid = -1;
+   }
+   if (dri2_surf->special_event) {
+      xcb_present_select_input(dri2_dpy->conn, dri2_surf->eid,
+                               dri2_surf->drawable, 0);
+      xcb_unregister_for_special_event(dri2_dpy->conn,
+                                       dri2_surf->special_event);
+      dri2_surf->special_event = NULL;
+   }
    xcb_free_gc(dri2_dpy->conn, dri2_surf->gc);
    xcb_free_gc(dri2_dpy->conn, dri2_surf->swapgc);
+   free(dri2_surf->convert_buf);
+   dri2_surf->convert_buf = NULL;
+   dri2_surf->convert_size = 0;
+}
+
+static void
+swrastHandlePresentEvent(struct dri2_egl_surface *dri2_surf,
+                         xcb_present_generic_event_t *ge)
+{
+   switch (ge->evtype) {
+   case XCB_PRESENT_CONFIGURE_NOTIFY: {
+      xcb_present_configure_notify_event_t *ce = (void *) ge;
+
+      dri2_surf->base.Width = ce->width;
+      dri2_surf->base.Height = ce->height;
+      break;
+   }
+   case XCB_PRESENT_COMPLETE_NOTIFY: {
+      xcb_present_complete_notify_event_t *ce = (void *) ge;
+
+      if (ce->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP)
+         break;
+
+      /* the serial is the low half of the sbc it was sent with */
+      dri2_surf->complete_sbc =
+         (dri2_surf->present_sbc & 0xffffffff00000000ull) | ce->serial;
+      if (dri2_surf->complete_sbc > dri2_surf->present_sbc)
+         dri2_surf->complete_sbc -= 0x100000000ull;
+      dri2_surf->complete_ust = ce->ust;
+      dri2_surf->complete_msc = ce->msc;
+      break;
+   }
+   case XCB_PRESENT_IDLE_NOTIFY: {
+      xcb_present_idle_notify_event_t *ie = (void *) ge;
+      int i;
+
+      for (i = 0; dri2_surf->present_buffers && i < SWRAST_PRESENT_BUFFERS; i++) {
+         if (dri2_surf->present_buffers[i].pixmap == ie->pixmap)
+            dri2_surf->present_buffers[i].busy = false;
+      }
+      break;
+   }
+   }
+}
+
+/**
+ * Drain the surface's Present event queue, tracking the window size.
+ */
+static void
+swrastProcessEvents(struct dri2_egl_display * dri2_dpy,
+                    struct dri2_egl_surface * dri2_surf)
+{
+   xcb_generic_event_t *ev;
+
+   if (!dri2_surf->special_event)
+      return;
+
+   while ((ev = xcb_poll_for_special_event(dri2_dpy->conn,
+                                           dri2_surf->special_event))) {
+      swrastHandlePresentEvent(dri2_surf, (void *) ev);
+      free(ev);
+   }
+}
+
+static void
+swrastGetDrawableInfo(__DRIdrawable * draw,
+                      int *x, int *y, int *w, int *h,
+                      void *loaderPrivate)
+{
+   struct dri2_egl_surface *dri2_surf = loaderPrivate;
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dri2_surf->base.Resource.Display);
+
+   xcb_get_geometry_cookie_t cookie;
+   xcb_get_geometry_reply_t *reply;
+   xcb_generic_error_t *error;
+
+   *x = *y = 0;
+   swrastProcessEvents(dri2_dpy, dri2_surf);
+   if (dri2_surf->geometry_valid) {
+      *w = dri2_surf->base.Width;
+      *h = dri2_surf->base.Height;
+      return;
+   }
+
+   *w = *h = 0;
+   cookie = xcb_get_geometry (dri2_dpy->conn, dri2_surf->drawable);
+   reply = xcb_get_geometry_reply (dri2_dpy->conn, cookie, &error);
+   if (reply == NULL) {
+      if (error != NULL) {
+         _eglLog(_EGL_WARNING, "error in xcb_get_geometry");
+         free(error);
+      }
+      return;
+   }
+
+   *w = dri2_surf->base.Width = reply->width;
+   *h = dri2_surf->base.Height = reply->height;
+   swrastCheckPresentSelect(dri2_dpy, dri2_surf);
+   dri2_surf->geometry_valid = dri2_surf->base.Type != EGL_WINDOW_BIT ||
+                               dri2_surf->special_event != NULL;
+   free(reply);
+}
+
+static void
+swrastCopyRows(char *dst, int dst_stride, const char *src, int src_stride,
+               int row_bytes, int h)
+{
+   int i;
+
+   if (dst_stride == row_bytes && src_stride == row_bytes) {
+      memcpy(dst, src, (size_t) row_bytes * h);
+      return;
+   }
+
+   for (i = 0; i < h; i++)
+      memcpy(dst + (size_t) i * dst_stride, src + (size_t) i * src_stride,
+             row_bytes);
+}
+
+static int
+swrastFormatBytes(enum swrast_format format)
+{
+   switch (format) {
+   case SWRAST_FORMAT_RGB565:
+      return 2;
+   case SWRAST_FORMAT_RGB888:
+      return 3;
+   default:
+      return 4;
+   }
+}
+
+/**
+ * Whether pixels in src can be handed over as dst unchanged. The server
+ * ignores padding bits, so dropping an alpha channel is free.
+ */
+static bool
+swrastFormatsCompatible(enum swrast_format src, enum swrast_format dst)
+{
+   if (src == dst || src == SWRAST_FORMAT_NONE || dst == SWRAST_FORMAT_NONE)
+      return true;
+
+   return (src == SWRAST_FORMAT_ARGB8888 && dst == SWRAST_FORMAT_XRGB8888) ||
+          (src == SWRAST_FORMAT_ARGB2101010 && dst == SWRAST_FORMAT_XRGB2101010);
+}
+
+/* Pixels converted per pass through the ARGB8888 staging array. The loops
+ * below are branch free per pixel so the compiler can vectorize them.
+ */
+#define SWRAST_CONVERT_CHUNK 256
+
+static void
+swrastUnpackRow(enum swrast_format format, uint32_t *dst,
+                const uint8_t *src, int n)
+{
+   int i;
+
+   switch (format) {
+   case SWRAST_FORMAT_RGB565:
+      for (i = 0; i < n; i++) {
+         uint16_t p;
+         uint32_t r, g, b;
+
+         memcpy(&p, src + 2 * i, sizeof(p));
+         r = (p >> 11) & 0x1f;
+         g = (p >> 5) & 0x3f;
+         b = p & 0x1f;
+         dst[i] = 0xff000000 | (r << 3 | r >> 2) << 16 |
+                  (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2);
+      }
+      break;
+   case SWRAST_FORMAT_RGB888:
+      for (i = 0; i < n; i++)
+         dst[i] = 0xff000000 | (uint32_t) src[3 * i + 2] << 16 |
+                  (uint32_t) src[3 * i + 1] << 8 | src[3 * i];
+      break;
+   case SWRAST_FORMAT_XRGB8888:
+      memcpy(dst, src, (size_t) n * 4);
+      for (i = 0; i < n; i++)
+         dst[i] |= 0xff000000;
+      break;
+   case SWRAST_FORMAT_XRGB2101010:
+   case SWRAST_FORMAT_ARGB2101010: {
+      uint32_t alpha = format == SWRAST_FORMAT_XRGB2101010 ? 3 : 0;
+
+      memcpy(dst, src, (size_t) n * 4);
+      for (i = 0; i < n; i++) {
+         uint32_t p = dst[i];
+
+         dst[i] = ((p >> 30 | alpha) * 0x55) << 24 |
+                  (p >> 22 & 0xff) << 16 | (p >> 12 & 0xff) << 8 |
+                  (p >> 2 & 0xff);
+      }
+      break;
+   }
+   default:
+      memcpy(dst, src, (size_t) n * 4);
+      break;
+   }
+}
+
+static void
+swrastPackRow(enum swrast_format format, uint8_t *dst,
+              const uint32_t *src, int n)
+{
+   int i;
+
+   switch (format) {
+   case SWRAST_FORMAT_RGB565:
+      for (i = 0; i < n; i++) {
+         uint32_t c = src[i];
+         uint16_t p = (c >> 8 & 0xf800) | (c >> 5 & 0x07e0) | (c >> 3 & 0x1f);
+
+         memcpy(dst + 2 * i, &p, sizeof(p));
+      }
+      break;
+   case SWRAST_FORMAT_RGB888:
+      for (i = 0; i < n; i++) {
+         dst[3 * i] = src[i];
+         dst[3 * i + 1] = src[i] >> 8;
+         dst[3 * i + 2] = src[i] >> 16;
+      }
+      break;
+   case SWRAST_FORMAT_XRGB2101010:
+   case SWRAST_FORMAT_ARGB2101010:
+      for (i = 0; i < n; i++) {
+         uint32_t c = src[i];
+         uint32_t r = c >> 16 & 0xff, g = c >> 8 & 0xff, b = c & 0xff;
+         uint32_t p = (c >> 30) << 30 | (r << 2 | r >> 6) << 20 |
+                      (g << 2 | g >> 6) << 10 | (b << 2 | b >> 6);
+
+         memcpy(dst + 4 * i, &p, sizeof(p));
+      }
+      break;
+   default:
+      memcpy(dst, src, (size_t) n * 4);
+      break;
+   }
+}
+
+/**
+ * Convert a w x h block between two layouts, going through ARGB8888 a
+ * chunk of pixels at a time.
+ */
+static void
+swrastConvertRows(char *dst, int dst_stride, enum swrast_format dst_format,
+                  const char *src, int src_stride, enum swrast_format src_format,
+                  int w, int h)
+{
+   uint32_t tmp[SWRAST_CONVERT_CHUNK];
+   int src_bpp = swrastFormatBytes(src_format);
+   int dst_bpp = swrastFormatBytes(dst_format);
+   int x, y, n;
+
+   for (y = 0; y < h; y++) {
+      const uint8_t *s = (const uint8_t *) src + (size_t) y * src_stride;
+      uint8_t *d = (uint8_t *) dst + (size_t) y * dst_stride;
+
+      for (x = 0; x < w; x += n) {
+         n = MIN2(w - x, SWRAST_CONVERT_CHUNK);
+         swrastUnpackRow(src_format, tmp, s + x * src_bpp, n);
+         swrastPackRow(dst_format, d + x * dst_bpp, tmp, n);
+      }
+   }
+}
+
+/**
+ * Row pitch of a w pixel wide image in the server's format.
+ */
+static int
+swrastServerStride(const struct dri2_egl_surface *dri2_surf, int w)
+{
+   int pad = MAX2(dri2_surf->scanline_pad, 1);
+
+   return DIV_ROUND_UP(w * dri2_surf->server_bytes_per_pixel, pad) * pad;
+}
+
+static bool
+swrastGetGC(struct dri2_egl_surface *dri2_surf, int op, xcb_gcontext_t *gc)
+{
+   switch (op) {
+   case __DRI_SWRAST_IMAGE_OP_DRAW:
+      *gc = dri2_surf->gc;
+      return true;
+   case __DRI_SWRAST_IMAGE_OP_SWAP:
+      *gc = dri2_surf->swapgc;
+      return true;
+   default:
+      return false;
+   }
+}
+
+/* Bytes a w x h block takes in the staging segment; blocks start 8 byte
+ * aligned.
+ */
+static size_t
+swrastShmBlockSize(const struct dri2_egl_surface *dri2_surf, bool convert,
+                   int w, int h)
+{
+   int row_bytes = convert ? swrastServerStride(dri2_surf, w)
+                           : w * dri2_surf->bytes_per_pixel;
+
+   return ((size_t) row_bytes * h + 7) & ~(size_t) 7;
+}
+
+/**
+ * Copy a w x h block into the staging segment at offset and queue the
+ * ShmPutImage for it. The caller waits for the segment to be idle first
+ * and fences it after the last block.
+ */
+static void
+swrastShmPutBlock(struct dri2_egl_display *dri2_dpy,
+                  struct dri2_egl_surface *dri2_surf, xcb_gcontext_t gc,
+                  bool convert, size_t offset, int x, int y, int w, int h,
+                  int stride, const char *data)
+{
+   int row_bytes = convert ? swrastServerStride(dri2_surf, w)
+                           : w * dri2_surf->bytes_per_pixel;
+   char *dst = (char *) dri2_surf->shm_addr + offset;
+
+   if (convert)
+      swrastConvertRows(dst, row_bytes, dri2_surf->server_format, data,
+                        stride, dri2_surf->dri_format, w, h);
+   else
+      swrastCopyRows(dst, row_bytes, data, stride, row_bytes, h);
+
+   xcb_shm_put_image(dri2_dpy->conn, dri2_surf->drawable, gc,
+                     w, h, 0, 0, w, h, x, y, dri2_surf->depth,
+                     XCB_IMAGE_FORMAT_Z_PIXMAP, false,
+                     dri2_surf->shmseg, offset);
+}
+
+static void
+swrastShmFence(struct dri2_egl_display *dri2_dpy,
+               struct dri2_egl_surface *dri2_surf)
+{
+   dri2_surf->shm_fence = xcb_get_input_focus(dri2_dpy->conn);
+   dri2_surf->shm_busy = true;
+   xcb_flush(dri2_dpy->conn);
+}
+
+/**
+ * Upload a w x h block whose rows are stride bytes apart.
+ */
+static void
+swrastXPutImage(struct dri2_egl_display *dri2_dpy,
+                struct dri2_egl_surface *dri2_surf, xcb_gcontext_t gc,
+                int x, int y, int w, int h, int stride, const char *data)
+{
+   bool convert = !swrastFormatsCompatible(dri2_surf->dri_format,
+                                           dri2_surf->server_format);
+   int row_bytes = convert ? swrastServerStride(dri2_surf, w)
+                           : w * dri2_surf->bytes_per_pixel;
+   size_t size = (size_t) row_bytes * h;
+   size_t rows;
+   int i;
+
+   /* With a local server let it read the pixels straight out of shared
+    * memory instead of streaming them through the socket. The copy into
+    * the segment has to wait for the previous upload to be consumed.
+    */
+   if (dri2_surf->shm_batch) {
+      size_t block = swrastShmBlockSize(dri2_surf, convert, w, h);
+
+      if (dri2_surf->shm_offset + block <= dri2_surf->shm_size) {
+         swrastShmPutBlock(dri2_dpy, dri2_surf, gc, convert,
+                           dri2_surf->shm_offset, x, y, w, h, stride, data);
+         dri2_surf->shm_offset += block;
+         return;
+      }
+
+      /* out of room: what is queued so far has to be consumed first */
+      if (dri2_surf->shm_offset)
+         swrastShmFence(dri2_dpy, dri2_surf);
+      dri2_surf->shm_batch = false;
+      dri2_surf->shm_offset = 0;
+   }
+
+   if (dri2_dpy->has_shm && swrastShmReserve(dri2_dpy, dri2_surf, size)) {
+      swrastShmWait(dri2_dpy, dri2_surf);
+      swrastShmPutBlock(dri2_dpy, dri2_surf, gc, convert, 0, x, y, w, h,
+                        stride, data);
+      swrastShmFence(dri2_dpy, dri2_surf);
+      return;
+   }
+
+   /* Convert into scratch memory that then goes out as a packed image. */
+   if (convert) {
+      if (dri2_surf->convert_size < size) {
+         void *buf = realloc(dri2_surf->convert_buf, size);
+
+         if (buf == NULL)
+            return;
+         dri2_surf->convert_buf = buf;
+         dri2_surf->convert_size = size;
+      }
+      swrastConvertRows(dri2_surf->convert_buf, row_bytes,
+                        dri2_surf->server_format, data, stride,
+                        dri2_surf->dri_format, w, h);
+      data = dri2_surf->convert_buf;
+      stride = row_bytes;
+   }
+
+   /* PutImage has no source stride, so when the rows are not packed send
+    * them one by one rather than repacking them. Otherwise split the image
+    * into strips that fit the connection's maximum request length; XCB
+    * queues them without flushing in between.
+    */
+   if (stride == row_bytes) {
+      size_t max_bytes = (size_t) xcb_get_maximum_request_length(dri2_dpy->conn) * 4;
+
+      /* BIG-REQUESTS adds a length field to the request header */
+      max_bytes -= sizeof(xcb_put_image_request_t) + 4;
+      rows = row_bytes ? max_bytes / (size_t) row_bytes : (size_t) h;
+   } else {
+      rows = 1;
+   }
+   rows = MAX2(rows, 1);
+
+   for (i = 0; i < h; i += rows) {
+      int strip = MIN2(rows, (size_t) (h - i));
+
+      xcb_put_image(dri2_dpy->conn, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                    dri2_surf->drawable, gc, w, strip, x, y + i, 0,
+                    dri2_surf->depth, (uint32_t) strip * row_bytes,
+                    (const uint8_t *) data + (size_t) i * stride);
+   }
+}
+
+/**
+ * Start packing the uploads of one frame, size bytes of swrastShmBlockSize
+ * blocks, into the staging segment. swrastXPutImage then appends each block
+ * after the previous one, and swrastShmEndBatch fences them all at once, so
+ * the frame waits for the server once rather than per rect.
+ */
+static void
+swrastShmBeginBatch(struct dri2_egl_display *dri2_dpy,
+                    struct dri2_egl_surface *dri2_surf, size_t size)
+{
+   if (!dri2_dpy->has_shm || !swrastShmReserve(dri2_dpy, dri2_surf, size))
+      return;
+
+   swrastShmWait(dri2_dpy, dri2_surf);
+   dri2_surf->shm_batch = true;
+   dri2_surf->shm_offset = 0;
+}
+
+static void
+swrastShmEndBatch(struct dri2_egl_display *dri2_dpy,
+                  struct dri2_egl_surface *dri2_surf)
+{
+   if (dri2_surf->shm_batch && dri2_surf->shm_offset)
+      swrastShmFence(dri2_dpy, dri2_surf);
+   dri2_surf->shm_batch = false;
+   dri2_surf->shm_offset = 0;
+}
+
+/**
+ * Upload n blocks of a frame whose rows are stride bytes apart, rects
+ * relative to data.
+ */
+static void
+swrastXPutRects(struct dri2_egl_display *dri2_dpy,
+                struct dri2_egl_surface *dri2_surf, xcb_gcontext_t gc,
+                const xcb_rectangle_t *rects, int n, int stride,
+                const char *data)
+{
+   bool convert = !swrastFormatsCompatible(dri2_surf->dri_format,
+                                           dri2_surf->server_format);
+   int bpp = dri2_surf->bytes_per_pixel;
+   size_t size = 0;
+   int i;
+
+   for (i = 0; n > 1 && i < n; i++)
+      size += swrastShmBlockSize(dri2_surf, convert, rects[i].width,
+                                 rects[i].height);
+   if (size)
+      swrastShmBeginBatch(dri2_dpy, dri2_surf, size);
+
+   for (i = 0; i < n; i++) {
+      const xcb_rectangle_t *r = &rects[i];
+
+      swrastXPutImage(dri2_dpy, dri2_surf, gc, r->x, r->y, r->width,
+                      r->height, stride,
+                      data + (size_t) r->y * stride + r->x * bpp);
+   }
+   swrastShmEndBatch(dri2_dpy, dri2_surf);
+}
+
+/**
+ * Read a w x h block into data, rows stride bytes apart.
+ */
+static void
+swrastXGetImage(struct dri2_egl_display *dri2_dpy,
+                struct dri2_egl_surface *dri2_surf,
+                int x, int y, int w, int h, int stride, char *data)
+{
+   xcb_get_image_cookie_t cookie;
+   xcb_get_image_reply_t *reply;
+   xcb_generic_error_t *error;
+   bool convert = !swrastFormatsCompatible(dri2_surf->server_format,
+                                           dri2_surf->dri_format);
+   int row_bytes = w * dri2_surf->bytes_per_pixel;
+   size_t size = (size_t) row_bytes * h;
+
+   if (h <= 0)
+      return;
+
+   if (convert)
+      size = (size_t) swrastServerStride(dri2_surf, w) * h;
+
+   /* Let the server blit into shared memory; only the reply header comes
+    * back over the socket. The server pads rows to 32 bits, so derive the
+    * source stride from the reply.
+    */
+   if (dri2_dpy->has_shm && swrastShmReserve(dri2_dpy, dri2_surf, size)) {
+      xcb_shm_get_image_cookie_t shm_cookie;
+      xcb_shm_get_image_reply_t *shm_reply;
+
+      swrastShmWait(dri2_dpy, dri2_surf);
+      shm_cookie = xcb_shm_get_image(dri2_dpy->conn, dri2_surf->drawable,
+                                     x, y, w, h, ~0,
+                                     XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                     dri2_surf->shmseg, 0);
+      shm_reply = xcb_shm_get_image_reply(dri2_dpy->conn, shm_cookie, &error);
+      if (shm_reply) {
+         if (shm_reply->size >= size && convert)
+            swrastConvertRows(data, stride, dri2_surf->dri_format,
+                              dri2_surf->shm_addr, shm_reply->size / h,
+                              dri2_surf->server_format, w, h);
+         else if (shm_reply->size >= size)
+            swrastCopyRows(data, stride, dri2_surf->shm_addr,
+                           shm_reply->size / h, row_bytes, h);
+         free(shm_reply);
+         return;
+      }
+
+      /* fall back to the plain request, which also logs the error */
+      free(error);
+   }
+
+   cookie = xcb_get_image (dri2_dpy->conn, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                           dri2_surf->drawable, x, y, w, h, ~0);
+   reply = xcb_get_image_reply (dri2_dpy->conn, cookie, &error);
+   if (reply == NULL) {
+      if (error != NULL) {
+         _eglLog(_EGL_WARNING, "error in xcb_get_image");
+         free(error);
+      }
+      return;
+   }
+
+   {
+      uint32_t bytes = (uint32_t) xcb_get_image_data_length(reply);
+      uint8_t *idata = xcb_get_image_data(reply);
+
+      if (bytes >= size && convert)
+         swrastConvertRows(data, stride, dri2_surf->dri_format,
+                           (const char *) idata, bytes / h,
+                           dri2_surf->server_format, w, h);
+      else if (bytes >= size)
+         swrastCopyRows(data, stride, (const char *) idata, bytes / h,
+                        row_bytes, h);
+   }
+   free(reply);
+}
+
+/**
+ * Attach a segment the driver renders into, so putImageShm/getImageShm can
+ * hand it to the server without copying. Only the most recent segment is
+ * kept attached.
+ */
+static bool
+swrastShmAttachDriverSegment(struct dri2_egl_display *dri2_dpy,
+                             struct dri2_egl_surface *dri2_surf, int shmid)
+{
+   xcb_void_cookie_t cookie;
+   xcb_generic_error_t *error;
+   xcb_shm_seg_t seg;
+
+   if (shmid == -1)
+      return false;
+
+   if (dri2_surf->dri_shmid == shmid)
+      return true;
+
+   if (dri2_surf->dri_shmid != -1) {
+      xcb_shm_detach(dri2_dpy->conn, dri2_surf->dri_shmseg);
+      dri2_surf->dri_shmid = -1;
+   }
+
+   seg = xcb_generate_id(dri2_dpy->conn);
+   cookie = xcb_shm_attach_checked(dri2_dpy->conn, seg, shmid, false);
+   error = xcb_request_check(dri2_dpy->conn, cookie);
+   if (error) {
+      free(error);
+      return false;
+   }
+
+   dri2_surf->dri_shmid = shmid;
+   dri2_surf->dri_shmseg = seg;
+
+   return true;
+}
+
+#define SWRAST_TILE_SIZE 64
+
+static inline uint64_t
+swrastLoad64(const char *p)
+{
+   uint64_t v;
+
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+/**
+ * Hash a block of pixels. Four independent multiply/xor lanes keep the
+ * loop free of serial dependencies so the compiler can interleave them.
+ */
+static uint64_t
+swrastHashTile(const char *data, int stride, int row_bytes, int rows)
+{
+   const uint64_t prime = 0x100000001b3ull;
+   uint64_t h0 = 0xcbf29ce484222325ull, h1 = h0 + 1, h2 = h0 + 2, h3 = h0 + 3;
+   int i, n;
+
+   for (i = 0; i < rows; i++) {
+      const char *p = data + (size_t) i * stride;
+
+      for (n = row_bytes; n >= 32; n -= 32, p += 32) {
+         h0 = (h0 ^ swrastLoad64(p)) * prime;
+         h1 = (h1 ^ swrastLoad64(p + 8)) * prime;
+         h2 = (h2 ^ swrastLoad64(p + 16)) * prime;
+         h3 = (h3 ^ swrastLoad64(p + 24)) * prime;
+      }
+      for (; n >= 8; n -= 8, p += 8)
+         h0 = (h0 ^ swrastLoad64(p)) * prime;
+      for (; n > 0; n--, p++)
+         h1 = (h1 ^ (uint8_t) *p) * prime;
+   }
+
+   h0 ^= (h1 << 17 | h1 >> 47) ^ (h2 << 31 | h2 >> 33) ^ (h3 << 47 | h3 >> 17);
+   return h0 ? h0 : 1;
+}
+
+/**
+ * Forget what is on screen for the tiles covering the given area, so the
+ * next full frame uploads them again.
+ */
+static void
+swrastTileInvalidate(struct dri2_egl_surface *dri2_surf,
+                     int x, int y, int w, int h)
+{
+   int tx, ty;
+
+   if (!dri2_surf->tile_hashes)
+      return;
+
+   for (ty = MAX2(y, 0) / SWRAST_TILE_SIZE;
+        ty < dri2_surf->tile_rows && ty * SWRAST_TILE_SIZE < y + h; ty++) {
+      for (tx = MAX2(x, 0) / SWRAST_TILE_SIZE;
+           tx < dri2_surf->tile_cols && tx * SWRAST_TILE_SIZE < x + w; tx++)
+         dri2_surf->tile_hashes[ty * dri2_surf->tile_cols + tx] = 0;
+   }
+}
+
+/**
+ * Compare a full frame against the tile hashes of the frame on screen and
+ * collect the changed tiles in dri2_surf->tile_rects. Dirty tiles next to
+ * each other in a row become one rectangle, and rectangles spanning the
+ * same columns in consecutive rows are merged.
+ *
+ * Returns the number of rectangles, or -1 if the whole frame has to be
+ * uploaded.
+ */
+static int
+swrastTileDamage(struct dri2_egl_surface *dri2_surf,
+                 const char *data, int stride, int w, int h)
+{
+   int bpp = dri2_surf->bytes_per_pixel;
+   int cols = DIV_ROUND_UP(w, SWRAST_TILE_SIZE);
+   int rows = DIV_ROUND_UP(h, SWRAST_TILE_SIZE);
+   int tx, ty, i, n = 0;
+
+   if (cols != dri2_surf->tile_cols || rows != dri2_surf->tile_rows) {
+      free(dri2_surf->tile_hashes);
+      free(dri2_surf->tile_rects);
+      dri2_surf->tile_hashes = calloc(cols * rows, sizeof(uint64_t));
+      dri2_surf->tile_rects = malloc(cols * rows * sizeof(xcb_rectangle_t));
+      if (!dri2_surf->tile_hashes || !dri2_surf->tile_rects) {
+         free(dri2_surf->tile_hashes);
+         free(dri2_surf->tile_rects);
+         dri2_surf->tile_hashes = NULL;
+         dri2_surf->tile_rects = NULL;
+         dri2_surf->tile_cols = dri2_surf->tile_rows = 0;
+         return -1;
+      }
+      dri2_surf->tile_cols = cols;
+      dri2_surf->tile_rows = rows;
+   } else if (w != dri2_surf->tile_width || h != dri2_surf->tile_height) {
+      /* the edge tiles changed size, and a window forgets its contents
+       * when resized unless its bit gravity says otherwise */
+      memset(dri2_surf->tile_hashes, 0, cols * rows * sizeof(uint64_t));
+   }
+   dri2_surf->tile_width = w;
+   dri2_surf->tile_height = h;
+
+   for (ty = 0; ty < rows; ty++) {
+      int y = ty * SWRAST_TILE_SIZE;
+      int th = MIN2(SWRAST_TILE_SIZE, h - y);
+      int run_start = -1;
+
+      for (tx = 0; tx <= cols; tx++) {
+         bool dirty = false;
+
+         if (tx < cols) {
+            int x = tx * SWRAST_TILE_SIZE;
+            int tw = MIN2(SWRAST_TILE_SIZE, w - x);
+            uint64_t *hash = &dri2_surf->tile_hashes[ty * cols + tx];
+            uint64_t value = swrastHashTile(data + (size_t) y * stride + x * bpp,
+                                            stride, tw * bpp, th);
+
+            dirty = *hash != value;
+            *hash = value;
+         }
+
+         if (dirty && run_start < 0) {
+            run_start = tx;
+         } else if (!dirty && run_start >= 0) {
+            int x0 = run_start * SWRAST_TILE_SIZE;
+            int x1 = MIN2(tx * SWRAST_TILE_SIZE, w);
+
+            run_start = -1;
+
+            /* extend a rectangle ending right above this run */
+            for (i = 0; i < n; i++) {
+               xcb_rectangle_t *r = &dri2_surf->tile_rects[i];
+
+               if (r->x == x0 && r->width == x1 - x0 && r->y + r->height == y)
+                  break;
+            }
+
+            if (i < n) {
+               dri2_surf->tile_rects[i].height += th;
+            } else {
+               dri2_surf->tile_rects[n].x = x0;
+               dri2_surf->tile_rects[n].y = y;
+               dri2_surf->tile_rects[n].width = x1 - x0;
+               dri2_surf->tile_rects[n].height = th;
+               n++;
+            }
+         }
+      }
+   }
+
+   return n;
+}
+
+/**
+ * Block until the next Present event for the surface arrives.
+ */
+static bool
+swrastPresentWaitEvent(struct dri2_egl_display *dri2_dpy,
+                       struct dri2_egl_surface *dri2_surf)
+{
+   xcb_generic_event_t *ev;
+
+   xcb_flush(dri2_dpy->conn);
+   ev = xcb_wait_for_special_event(dri2_dpy->conn, dri2_surf->special_event);
+   if (!ev)
+      return false;
+
+   swrastHandlePresentEvent(dri2_surf, (void *) ev);
+   free(ev);
+
+   return true;
+}
+
+/**
+ * Wait until every frame sent with PresentPixmap has been shown, so that
+ * drawing to or reading from the window directly sees the newest frame
+ * and is not overwritten by one still waiting for its MSC.
+ */
+static void
+swrastPresentWaitComplete(struct dri2_egl_display *dri2_dpy,
+                          struct dri2_egl_surface *dri2_surf)
+{
+   if (!dri2_surf->present_buffers)
+      return;
+
+   while (dri2_surf->complete_sbc < dri2_surf->present_sbc) {
+      if (!swrastPresentWaitEvent(dri2_dpy, dri2_surf))
+         break;
+   }
+}
+
+static void
+swrastPresentBufferRelease(struct dri2_egl_display *dri2_dpy,
+                           struct swrast_present_buffer *buffer)
+{
+   if (!buffer->pixmap)
+      return;
+
+   xcb_free_pixmap(dri2_dpy->conn, buffer->pixmap);
+   xcb_shm_detach(dri2_dpy->conn, buffer->shmseg);
+   shmdt(buffer->addr);
+   memset(buffer, 0, sizeof(*buffer));
+}
+
+/**
+ * Back buffer with a w x h SHM pixmap in the server's format. Like the
+ * staging segment it is marked for removal once the server attached it.
+ */
+static bool
+swrastPresentBufferAlloc(struct dri2_egl_display *dri2_dpy,
+                         struct dri2_egl_surface *dri2_surf,
+                         struct swrast_present_buffer *buffer, int w, int h)
+{
+   xcb_void_cookie_t cookie;
+   xcb_generic_error_t *error;
+   int stride = swrastServerStride(dri2_surf, w);
+   void *addr;
+   int id;
+
+   id = shmget(IPC_PRIVATE, (size_t) stride * h, IPC_CREAT | 0600);
+   if (id == -1)
+      return false;
+
+   addr = shmat(id, NULL, 0);
+   if (addr == (void *) -1) {
+      shmctl(id, IPC_RMID, NULL);
+      return false;
+   }
+
+   buffer->shmseg = xcb_generate_id(dri2_dpy->conn);
+   cookie = xcb_shm_attach_checked(dri2_dpy->conn, buffer->shmseg, id, false);
+   error = xcb_request_check(dri2_dpy->conn, cookie);
+   shmctl(id, IPC_RMID, NULL);
+   if (error) {
+      free(error);
+      shmdt(addr);
+      return false;
+   }
+
+   buffer->pixmap = xcb_generate_id(dri2_dpy->conn);
+   xcb_shm_create_pixmap(dri2_dpy->conn, buffer->pixmap, dri2_surf->drawable,
+                         w, h, dri2_surf->depth, buffer->shmseg, 0);
+   buffer->addr = addr;
+   buffer->width = w;
+   buffer->height = h;
+   buffer->stride = stride;
+   buffer->busy = false;
+
+   return true;
+}
+
+static void
+swrastPresentBuffersFree(struct dri2_egl_display *dri2_dpy,
+                         struct dri2_egl_surface *dri2_surf)
+{
+   int i;
+
+   if (!dri2_surf->present_buffers)
+      return;
+
+   for (i = 0; i < SWRAST_PRESENT_BUFFERS; i++)
+      swrastPresentBufferRelease(dri2_dpy, &dri2_surf->present_buffers[i]);
+   free(dri2_surf->present_buffers);
+   dri2_surf->present_buffers = NULL;
+}
+
+/**
+ * Copy a whole frame into an idle SHM pixmap and queue it with
+ * PresentPixmap, honouring the surface's swap interval. The server copies
+ * or flips it at the target MSC and reports back with CompleteNotify and,
+ * once it no longer reads the pixmap, IdleNotify.
+ *
+ * Returns false if no pixmap could be set up; the caller then falls back
+ * to PutImage.
+ */
+static bool
+swrastPresentFrame(struct dri2_egl_display *dri2_dpy,
+                   struct dri2_egl_surface *dri2_surf,
+                   int w, int h, int stride, const char *data)
+{
+   struct swrast_present_buffer *buffer = NULL;
+   EGLint interval = dri2_surf->base.SwapInterval;
+   uint32_t options = XCB_PRESENT_OPTION_NONE;
+   uint64_t target_msc = 0;
+   int i;
+
+   if (w <= 0 || h <= 0)
+      return false;
+
+   swrastProcessEvents(dri2_dpy, dri2_surf);
+   while (!buffer) {
+      for (i = 0; i < SWRAST_PRESENT_BUFFERS; i++) {
+         if (!dri2_surf->present_buffers[i].busy) {
+            buffer = &dri2_surf->present_buffers[i];
+            break;
+         }
+      }
+      if (!buffer && !swrastPresentWaitEvent(dri2_dpy, dri2_surf))
+         return false;
+   }
+
+   if (buffer->width != w || buffer->height != h) {
+      swrastPresentBufferRelease(dri2_dpy, buffer);
+      if (!swrastPresentBufferAlloc(dri2_dpy, dri2_surf, buffer, w, h))
+         return false;
+   }
+
+   if (!swrastFormatsCompatible(dri2_surf->dri_format,
+                                dri2_surf->server_format))
+      swrastConvertRows(buffer->addr, buffer->stride,
+                        dri2_surf->server_format, data, stride,
+                        dri2_surf->dri_format, w, h);
+   else
+      swrastCopyRows(buffer->addr, buffer->stride, data, stride,
+                     w * dri2_surf->bytes_per_pixel, h);
+
+   /* Queue each frame interval MSCs after the one before it. Mailbox
+    * frames all target the next MSC instead, where the server skips
+    * every queued one but the newest.
+    */
+   if (interval == 0 && dri2_surf->base.PresentMailbox)
+      target_msc = dri2_surf->complete_msc + 1;
+   else if (interval == 0)
+      options |= XCB_PRESENT_OPTION_ASYNC;
+   else
+      target_msc = dri2_surf->complete_msc + interval *
+                   (dri2_surf->present_sbc + 1 - dri2_surf->complete_sbc);
+
+   dri2_surf->present_sbc++;
+   xcb_present_pixmap(dri2_dpy->conn, dri2_surf->drawable, buffer->pixmap,
+                      (uint32_t) dri2_surf->present_sbc, 0, 0, 0, 0, 0, 0, 0,
+                      options, target_msc, 0, 0, 0, NULL);
+   buffer->busy = true;
+   xcb_flush(dri2_dpy->conn);
+
+   /* the tile hashes no longer describe what the window shows */
+   if (dri2_surf->tile_damage)
+      swrastTileInvalidate(dri2_surf, 0, 0, w, h);
+
+   return true;
+}
+
+/**
+ * Send a block the driver put, applying tile damage to whole frames.
+ */
+static void
+swrastUploadImage(struct dri2_egl_display *dri2_dpy,
+                  struct dri2_egl_surface *dri2_surf, xcb_gcontext_t gc,
+                  bool full_frame, int x, int y, int w, int h, int stride,
+                  const char *data)
+{
+   /* Opt-in: only send the tiles of a full frame that changed since the
+    * last one. Partial puts just mark their tiles as unknown.
+    */
+   if (dri2_surf->tile_damage) {
+      if (full_frame) {
+         int n = swrastTileDamage(dri2_surf, data, stride, w, h);
+
+         if (n >= 0) {
+            swrastXPutRects(dri2_dpy, dri2_surf, gc, dri2_surf->tile_rects,
+                            n, stride, data);
+            return;
+         }
+      } else {
+         swrastTileInvalidate(dri2_surf, x, y, w, h);
+      }
+   }
+
+   swrastXPutImage(dri2_dpy, dri2_surf, gc, x, y, w, h, stride, data);
+}
+
+/* Frames a presenter holds before swaps block: one being sent and one
+ * waiting.
+ */
+#define SWRAST_PRESENT_QUEUE_DEPTH 2
+
+struct swrast_present_frame {
+   xcb_gcontext_t gc;
+   bool full_frame;
+   int x, y, w, h;
+   char *data;              /* w x h, rows packed */
+   size_t size;             /* allocated bytes */
+};
+
+/**
+ * Per-window thread that sends swapped frames to the server, so the render
+ * thread only pays for a copy of the back buffer. Every other request that
+ * touches the drawable's pixels waits for the queue to drain first, which
+ * keeps them ordered and leaves the upload state to one thread at a time.
+ */
+struct swrast_presenter {
+   struct dri2_egl_display *dri2_dpy;
+   struct dri2_egl_surface *dri2_surf;
+   thrd_t thread;
+   mtx_t mutex;
+   cnd_t cond;
+   struct swrast_present_frame frames[SWRAST_PRESENT_QUEUE_DEPTH];
+   unsigned head;           /* oldest queued frame */
+   unsigned count;          /* queued frames, including the one being sent */
+   bool quit;
+};
+
+static int
+swrastPresenterThread(void *arg)
+{
+   struct swrast_presenter *presenter = arg;
+   struct dri2_egl_surface *dri2_surf = presenter->dri2_surf;
+
+   mtx_lock(&presenter->mutex);
+   for (;;) {
+      struct swrast_present_frame *frame;
+
+      while (presenter->count == 0 && !presenter->quit)
+         cnd_wait(&presenter->cond, &presenter->mutex);
+      if (presenter->count == 0)
+         break;
+
+      /* the queue never hands out the head slot while it is counted */
+      frame = &presenter->frames[presenter->head];
+      mtx_unlock(&presenter->mutex);
+
+      swrastUploadImage(presenter->dri2_dpy, dri2_surf, frame->gc,
+                        frame->full_frame, frame->x, frame->y,
+                        frame->w, frame->h,
+                        frame->w * dri2_surf->bytes_per_pixel, frame->data);
+      xcb_flush(presenter->dri2_dpy->conn);
+
+      mtx_lock(&presenter->mutex);
+      presenter->head = (presenter->head + 1) % SWRAST_PRESENT_QUEUE_DEPTH;
+      presenter->count--;
+      cnd_broadcast(&presenter->cond);
+   }
+   mtx_unlock(&presenter->mutex);
+
+   return 0;
+}
+
+static void
+swrastPresenterStart(struct dri2_egl_display *dri2_dpy,
+                     struct dri2_egl_surface *dri2_surf)
+{
+   struct swrast_presenter *presenter;
+
+   presenter = calloc(1, sizeof(*presenter));
+   if (!presenter)
+      return;
+
+   presenter->dri2_dpy = dri2_dpy;
+   presenter->dri2_surf = dri2_surf;
+   if (mtx_init(&presenter->mutex, mtx_plain) != thrd_success)
+      goto cleanup_presenter;
+   if (cnd_init(&presenter->cond) != thrd_success)
+      goto cleanup_mutex;
+   if (thrd_create(&presenter->thread, swrastPresenterThread,
+                   presenter) != thrd_success)
+      goto cleanup_cond;
+
+   dri2_surf->presenter = presenter;
+   return;
+
+ cleanup_cond:
+   cnd_destroy(&presenter->cond);
+ cleanup_mutex:
+   mtx_destroy(&presenter->mutex);
+ cleanup_presenter:
+   _eglLog(_EGL_WARNING, "DRI2: failed to start the swrast presenter");
+   free(presenter);
+}
+
+/**
+ * Wait until every queued frame has been sent.
+ */
+static void
+swrastPresenterDrain(struct dri2_egl_surface *dri2_surf)
+{
+   struct swrast_presenter *presenter = dri2_surf->presenter;
+
+   if (!presenter)
+      return;
+
+   mtx_lock(&presenter->mutex);
+   while (presenter->count)
+      cnd_wait(&presenter->cond, &presenter->mutex);
+   mtx_unlock(&presenter->mutex);
+}
+
+static void
+swrastPresenterStop(struct dri2_egl_surface *dri2_surf)
+{
+   struct swrast_presenter *presenter = dri2_surf->presenter;
+   int i;
+
+   if (!presenter)
+      return;
+
+   mtx_lock(&presenter->mutex);
+   presenter->quit = true;
+   cnd_broadcast(&presenter->cond);
+   mtx_unlock(&presenter->mutex);
+   thrd_join(presenter->thread, NULL);
+
+   for (i = 0; i < SWRAST_PRESENT_QUEUE_DEPTH; i++)
+      free(presenter->frames[i].data);
+   cnd_destroy(&presenter->cond);
+   mtx_destroy(&presenter->mutex);
+   free(presenter);
+   dri2_surf->presenter = NULL;
+}
+
+/**
+ * Copy a swapped block into the presenter's queue, blocking while the
+ * queue is full. Returns false if the copy could not be made, in which
+ * case the caller sends the block itself.
+ */
+static bool
+swrastPresenterQueue(struct dri2_egl_surface *dri2_surf, xcb_gcontext_t gc,
+                     bool full_frame, int x, int y, int w, int h, int stride,
+                     const char *data)
+{
+   struct swrast_presenter *presenter = dri2_surf->presenter;
+   struct swrast_present_frame *frame;
+   int row_bytes = w * dri2_surf->bytes_per_pixel;
+   size_t size = (size_t) row_bytes * h;
+
+   mtx_lock(&presenter->mutex);
+   while (presenter->count == SWRAST_PRESENT_QUEUE_DEPTH) {
+      struct swrast_present_frame *last =
+         &presenter->frames[(presenter->head + presenter->count - 1) %
+                            SWRAST_PRESENT_QUEUE_DEPTH];
+
+      /* Mailbox: take back the frame still waiting to be sent and put
+       * this one in its place, rather than waiting behind it.
+       */
+      if (dri2_surf->base.PresentMailbox && dri2_surf->base.SwapInterval == 0 &&
+          full_frame && last->full_frame) {
+         presenter->count--;
+         break;
+      }
+      cnd_wait(&presenter->cond, &presenter->mutex);
+   }
+   frame = &presenter->frames[(presenter->head + presenter->count) %
+                              SWRAST_PRESENT_QUEUE_DEPTH];
+   mtx_unlock(&presenter->mutex);
+
+   /* Only this thread queues frames, so the free slot stays ours. */
+   if (frame->size < size) {
+      char *buf = realloc(frame->data, size);
+
+      if (buf == NULL) {
+         swrastPresenterDrain(dri2_surf);
+         return false;
+      }
+      frame->data = buf;
+      frame->size = size;
+   }
+
+   swrastCopyRows(frame->data, row_bytes, data, stride, row_bytes, h);
+   frame->gc = gc;
+   frame->full_frame = full_frame;
+   frame->x = x;
+   frame->y = y;
+   frame->w = w;
+   frame->h = h;
+
+   mtx_lock(&presenter->mutex);
+   presenter->count++;
+   cnd_broadcast(&presenter->cond);
+   mtx_unlock(&presenter->mutex);
+
+   return true;
+}
+
+static void
+swrastPutImage2(__DRIdrawable * draw, int op,
+                int x, int y, int w, int h, int stride,
+                char *data, void *loaderPrivate)
+{
+   struct dri2_egl_surface *dri2_surf = loaderPrivate;
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dri2_surf->base.Resource.Display);
+   xcb_gcontext_t gc;
+   bool full_frame;
+
+   if (!swrastGetGC(dri2_surf, op, &gc))
+      return;
+
+   full_frame = op == __DRI_SWRAST_IMAGE_OP_SWAP && x == 0 && y == 0 &&
+                w == dri2_surf->base.Width && h == dri2_surf->base.Height;
+
+   if (dri2_surf->present_buffers) {
+      if (full_frame &&
+          swrastPresentFrame(dri2_dpy, dri2_surf, w, h, stride, data))
+         return;
+      swrastPresentWaitComplete(dri2_dpy, dri2_surf);
+   }
+
+   if (dri2_surf->presenter) {
+      if (op == __DRI_SWRAST_IMAGE_OP_SWAP &&
+          swrastPresenterQueue(dri2_surf, gc, full_frame, x, y, w, h,
+                               stride, data))
+         return;
+      swrastPresenterDrain(dri2_surf);
+   }
+
+   swrastUploadImage(dri2_dpy, dri2_surf, gc, full_frame, x, y, w, h,
+                     stride, data);
+}
+
+static void
+swrastPutImage(__DRIdrawable * draw, int op,
+               int x, int y, int w, int h,
+               char *data, void *loaderPrivate)
+{
+   struct dri2_egl_surface *dri2_surf = loaderPrivate;
+
+   swrastPutImage2(draw, op, x, y, w, h, w * dri2_surf->bytes_per_pixel,
+                   data, loaderPrivate);
+}
+
+static void
+swrastPutImageShm(__DRIdrawable * draw, int op,
+                  int x, int y, int w, int h, int stride,
+                  int shmid, char *shmaddr, unsigned offset,
+                  void *loaderPrivate)
+{
+   struct dri2_egl_surface *dri2_surf = loaderPrivate;
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dri2_surf->base.Resource.Display);
+   int bpp = dri2_surf->bytes_per_pixel;
+   xcb_gcontext_t gc;
+
+   if (!swrastGetGC(dri2_surf, op, &gc))
+      return;
+
+   if (dri2_surf->present_buffers) {
+      if (op == __DRI_SWRAST_IMAGE_OP_SWAP && x == 0 && y == 0 &&
+          w == dri2_surf->base.Width && h == dri2_surf->base.Height &&
+          swrastPresentFrame(dri2_dpy, dri2_surf, w, h, stride,
+                             shmaddr + offset))
+         return;
+      swrastPresentWaitComplete(dri2_dpy, dri2_surf);
+   }
+
+   /* The driver reuses the segment once we return, so a queued frame
+    * still has to be a copy; that beats waiting for the server.
+    */
+   if (dri2_surf->presenter) {
+      if (op == __DRI_SWRAST_IMAGE_OP_SWAP &&
+          swrastPresenterQueue(dri2_surf, gc, false, x, y, w, h, stride,
+                               shmaddr + offset))
+         return;
+      swrastPresenterDrain(dri2_surf);
+   }
+
+   /* shared memory uploads are cheap enough to skip tile tracking */
+   if (dri2_surf->tile_damage)
+      swrastTileInvalidate(dri2_surf, x, y, w, h);
+
+   if (bpp == 0 || stride % bpp != 0 ||
+       !swrastFormatsCompatible(dri2_surf->dri_format,
+                                dri2_surf->server_format) ||
+       !swrastShmAttachDriverSegment(dri2_dpy, dri2_surf, shmid)) {
+      swrastXPutImage(dri2_dpy, dri2_surf, gc, x, y, w, h, stride,
+                      shmaddr + offset);
+      return;
+   }
+
+   xcb_shm_put_image(dri2_dpy->conn, dri2_surf->drawable, gc,
+                     stride / bpp, h, 0, 0, w, h, x, y, dri2_surf->depth,
+                     XCB_IMAGE_FORMAT_Z_PIXMAP, false,
+                     dri2_surf->dri_shmseg, offset);
+
+   /* The driver renders into this memory again as soon as we return. */
+   free(xcb_get_input_focus_reply(dri2_dpy->conn,
+                                  xcb_get_input_focus(dri2_dpy->conn), NULL));
+}
+
+static void
+swrastGetImage2(__DRIdrawable * read,
+                int x, int y, int w, int h, int stride,
+                char *data, void *loaderPrivate)
+{
+   struct dri2_egl_surface *dri2_surf = loaderPrivate;
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dri2_surf->base.Resource.Display);
+
+   swrastPresenterDrain(dri2_surf);
+   swrastPresentWaitComplete(dri2_dpy, dri2_surf);
+   swrastXGetImage(dri2_dpy, dri2_surf, x, y, w, h, stride, data);
+}
+
+static void
+swrastGetImage(__DRIdrawable * read,
+               int x, int y, int w, int h,
+               char *data, void *loaderPrivate)
+{
+   struct dri2_egl_surface *dri2_surf = loaderPrivate;
+
+   swrastGetImage2(read, x, y, w, h, w * dri2_surf->bytes_per_pixel,
+                   data, loaderPrivate);
+}
+
+static void
+swrastGetImageShm(__DRIdrawable * read,
+                  int x, int y, int w, int h,
+                  int shmid, void *loaderPrivate)
+{
+   struct dri2_egl_surface *dri2_surf = loaderPrivate;
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dri2_surf->base.Resource.Display);
+   xcb_shm_get_image_cookie_t cookie;
+   char *addr;
+
+   swrastPresenterDrain(dri2_surf);
+   swrastPresentWaitComplete(dri2_dpy, dri2_surf);
+
+   if (swrastFormatsCompatible(dri2_surf->server_format,
+                               dri2_surf->dri_format) &&
+       swrastShmAttachDriverSegment(dri2_dpy, dri2_surf, shmid)) {
+      cookie = xcb_shm_get_image(dri2_dpy->conn, dri2_surf->drawable,
+                                 x, y, w, h, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                 dri2_surf->dri_shmseg, 0);
+      free(xcb_shm_get_image_reply(dri2_dpy->conn, cookie, NULL));
+      return;
+   }
+
+   addr = shmat(shmid, NULL, 0);
+   if (addr == (void *) -1)
+      return;
+
+   swrastXGetImage(dri2_dpy, dri2_surf, x, y, w, h,
+                   w * dri2_surf->bytes_per_pixel, addr);
+   shmdt(addr);
+}
+
+
+static xcb_screen_t *
+get_xcb_screen(xcb_screen_iterator_t iter, int screen)
+{
+    for (; iter.rem; --screen, xcb_screen_next(&iter))
+        if (screen == 0)
+            return iter.data;
+
+    return NULL;
+}
+
+
+/**
+ * Tile damage skips tiles the server is assumed to still show, which only
+ * holds for windows whose contents survive being covered. Ask for the
+ * window's backing store along with the geometry.
+ */
+static bool
+dri2_x11_needs_window_attributes(struct dri2_egl_display *dri2_dpy,
+                                 struct dri2_egl_surface *dri2_surf)
+{
+   return dri2_dpy->swrast && dri2_dpy->tile_damage &&
+          dri2_surf->base.Type == EGL_WINDOW_BIT;
+}
+
+/**
+ * Queue the server requests needed to realize a surface without waiting
+ * for their replies.
+ *
+ * Window and pixmap surfaces send these from eglCreate*Surface, so the
+ * replies are in flight by the time the surface is used.  XCB only flushes
+ * its output buffer when a reply is awaited, so an application creating
+ * several surfaces back to back gets all their requests in one batch.
+ * DRI2CreateDrawable goes ahead of GetGeometry so that the geometry reply
+ * also settles the checked request.
+ */
+static void
+dri2_x11_send_surface_requests(struct dri2_egl_display *dri2_dpy,
+                               struct dri2_egl_surface *dri2_surf)
+{
+   if (dri2_dpy->dri2)
+      dri2_surf->create_cookie =
+         xcb_dri2_create_drawable_checked(dri2_dpy->conn, dri2_surf->drawable);
+
+   if (dri2_surf->base.Type != EGL_PBUFFER_BIT)
+      dri2_surf->geometry_cookie =
+         xcb_get_geometry (dri2_dpy->conn, dri2_surf->drawable);
+
+   if (dri2_x11_needs_window_attributes(dri2_dpy, dri2_surf))
+      dri2_surf->attributes_cookie =
+         xcb_get_window_attributes(dri2_dpy->conn, dri2_surf->drawable);
+
+   dri2_surf->requests_pending = true;
+}
+
+/**
+ * Undo a DRI2CreateDrawable whose outcome was never checked.
+ */
+static void
+dri2_x11_discard_create_drawable(struct dri2_egl_display *dri2_dpy,
+                                 struct dri2_egl_surface *dri2_surf)
+{
+   xcb_void_cookie_t cookie;
+
+   xcb_discard_reply(dri2_dpy->conn, dri2_surf->create_cookie.sequence);
+
+   /* We don't know whether the server accepted the drawable; keep a
+    * possible BadDrawable away from the application's error handler.
+    */
+   cookie = xcb_dri2_destroy_drawable_checked(dri2_dpy->conn,
+                                              dri2_surf->drawable);
+   xcb_discard_reply(dri2_dpy->conn, cookie.sequence);
+}
+
+/**
+ * Drop the replies of a surface destroyed before it was ever realized.
+ */
+static void
+dri2_x11_cancel_surface_requests(struct dri2_egl_display *dri2_dpy,
+                                 struct dri2_egl_surface *dri2_surf)
+{
+   if (!dri2_surf->requests_pending)
+      return;
+
+   if (dri2_dpy->dri2)
+      dri2_x11_discard_create_drawable(dri2_dpy, dri2_surf);
+
+   if (dri2_surf->base.Type != EGL_PBUFFER_BIT)
+      xcb_discard_reply(dri2_dpy->conn, dri2_surf->geometry_cookie.sequence);
+
+   if (dri2_x11_needs_window_attributes(dri2_dpy, dri2_surf))
+      xcb_discard_reply(dri2_dpy->conn,
+                        dri2_surf->attributes_cookie.sequence);
+
+   dri2_surf->requests_pending = false;
+}
+
+/*
+ * DRI2 InvalidateBuffers is a core-style extension event, which XCB can
+ * only hand to whoever reads the connection's event queue. When the
+ * application gave us an Xlib Display we can do what GLX does and catch
+ * it on its way through Xlib; the hook is shared by every EGL display on
+ * the same Display and the surfaces to notify sit on one list.
+ */
+typedef Bool (*dri2_x11_wire_to_event_proc)(Display *, XEvent *, xEvent *);
+
+struct dri2_x11_invalidate_hook {
+   Display *dpy;
+   int event_code;
+   dri2_x11_wire_to_event_proc prev;
+   int ref_count;
+   struct dri2_x11_invalidate_hook *next;
+};
+
+/* Never held while taking the Xlib display lock: Xlib calls
+ * dri2_x11_wire_to_event with that lock held.
+ */
+static mtx_t dri2_x11_invalidate_mutex = _MTX_INITIALIZER_NP;
+static struct dri2_x11_invalidate_hook *dri2_x11_invalidate_hooks;
+static struct dri2_egl_surface *dri2_x11_invalidate_surfaces;
+
+static Bool
+dri2_x11_wire_to_event(Display *dpy, XEvent *event, xEvent *wire)
+{
+   const xcb_dri2_invalidate_buffers_event_t *ev = (const void *) wire;
+   struct dri2_x11_invalidate_hook *hook;
+   struct dri2_egl_surface *dri2_surf;
+   dri2_x11_wire_to_event_proc prev = NULL;
+   int code = wire->u.u.type & 0x7f;
+
+   mtx_lock(&dri2_x11_invalidate_mutex);
+   for (hook = dri2_x11_invalidate_hooks; hook; hook = hook->next) {
+      if (hook->dpy == dpy && hook->event_code == code)
+         break;
+   }
+
+   if (hook) {
+      prev = hook->prev;
+      for (dri2_surf = dri2_x11_invalidate_surfaces; dri2_surf;
+           dri2_surf = dri2_surf->invalidate_next) {
+         struct dri2_egl_display *dri2_dpy =
+            dri2_egl_display(dri2_surf->base.Resource.Display);
+
+         if (dri2_dpy->invalidate_hook == hook &&
+             dri2_surf->drawable == ev->drawable)
+            (*dri2_dpy->flush->invalidate)(dri2_surf->dri_drawable);
+      }
+   }
+   mtx_unlock(&dri2_x11_invalidate_mutex);
+
+   /* GLX may be watching the same event for its own drawables. */
+   if (prev)
+      return prev(dpy, event, wire);
+
+   return False;
+}
+
+/**
+ * Start delivering InvalidateBuffers events for this display's drawables
+ * to the driver.
+ */
+static void
+dri2_x11_hook_invalidate(struct dri2_egl_display *dri2_dpy, Display *dpy)
+{
+   const xcb_query_extension_reply_t *extension;
+   struct dri2_x11_invalidate_hook *hook;
+   dri2_x11_wire_to_event_proc prev;
+   bool install = false;
+
+   extension = xcb_get_extension_data(dri2_dpy->conn, &xcb_dri2_id);
+   if (!(extension && extension->present))
+      return;
+
+   mtx_lock(&dri2_x11_invalidate_mutex);
+   for (hook = dri2_x11_invalidate_hooks; hook; hook = hook->next) {
+      if (hook->dpy == dpy)
+         break;
+   }
+   if (!hook) {
+      hook = calloc(1, sizeof(*hook));
+      if (!hook) {
+         mtx_unlock(&dri2_x11_invalidate_mutex);
+         return;
+      }
+      hook->dpy = dpy;
+      hook->event_code = extension->first_event + XCB_DRI2_INVALIDATE_BUFFERS;
+      hook->next = dri2_x11_invalidate_hooks;
+      dri2_x11_invalidate_hooks = hook;
+      install = true;
+   }
+   hook->ref_count++;
+   dri2_dpy->invalidate_hook = hook;
+   mtx_unlock(&dri2_x11_invalidate_mutex);
+
+   if (install) {
+      prev = XESetWireToEvent(dpy, hook->event_code, dri2_x11_wire_to_event);
+
+      mtx_lock(&dri2_x11_invalidate_mutex);
+      hook->prev = prev;
+      mtx_unlock(&dri2_x11_invalidate_mutex);
+   }
+}
+
+/**
+ * Whether Xlib still calls dri2_x11_wire_to_event for the event. It has no
+ * getter, so swap ours in and put back whatever was there; a library that
+ * hooked after us without chaining has taken the events away. One that
+ * does chain looks the same, which only costs the forced invalidate.
+ */
+static bool
+dri2_x11_hook_installed(struct dri2_x11_invalidate_hook *hook)
+{
+   dri2_x11_wire_to_event_proc cur;
+
+   cur = XESetWireToEvent(hook->dpy, hook->event_code,
+                          dri2_x11_wire_to_event);
+   if (cur != dri2_x11_wire_to_event)
+      XESetWireToEvent(hook->dpy, hook->event_code, cur);
+
+   return cur == dri2_x11_wire_to_event;
+}
+
+void
+dri2_teardown_x11(struct dri2_egl_display *dri2_dpy)
+{
+   struct dri2_x11_invalidate_hook *hook = dri2_dpy->invalidate_hook;
+   struct dri2_x11_invalidate_hook **link;
+   bool remove;
+
+   if (!hook)
+      return;
+
+   mtx_lock(&dri2_x11_invalidate_mutex);
+   remove = --hook->ref_count == 0;
+   if (remove) {
+      for (link = &dri2_x11_invalidate_hooks; *link != hook;
+           link = &(*link)->next)
+         ;
+      *link = hook->next;
+   }
+   mtx_unlock(&dri2_x11_invalidate_mutex);
+
+   /* Only unhook if nobody (GLX, say) has hooked after us; otherwise leave
+    * their handler in place. If it chains to us, dri2_x11_wire_to_event
+    * no longer finds the hook and just returns.
+    */
+   if (remove) {
+      dri2_x11_wire_to_event_proc cur;
+
+      cur = XESetWireToEvent(hook->dpy, hook->event_code, hook->prev);
+      if (cur != dri2_x11_wire_to_event)
+         XESetWireToEvent(hook->dpy, hook->event_code, cur);
+      free(hook);
+   }
+   dri2_dpy->invalidate_hook = NULL;
 }
 
 static void
-swrastGetDrawableInfo(__DRIdrawable * draw,
-                      int *x, int *y, int *w, int *h,
-                      void *loaderPrivate)
+dri2_x11_watch_invalidate(struct dri2_egl_display *dri2_dpy,
+                          struct dri2_egl_surface *dri2_surf)
 {
-   struct dri2_egl_surface *dri2_surf = loaderPrivate;
-   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dri2_surf->base.Resource.Display);
-
-   xcb_get_geometry_cookie_t cookie;
-   xcb_get_geometry_reply_t *reply;
-   xcb_generic_error_t *error;
-
-   *w = *h = 0;
-   cookie = xcb_get_geometry (dri2_dpy->conn, dri2_surf->drawable);
-   reply = xcb_get_geometry_reply (dri2_dpy->conn, cookie, &error);
-   if (reply == NULL)
+   if (!dri2_dpy->invalidate_hook)
       return;
 
-   if (error != NULL) {
-      _eglLog(_EGL_WARNING, "error in xcb_get_geometry");
-      free(error);
-   } else {
-      *w = reply->width;
-      *h = reply->height;
-   }
-   free(reply);
+   mtx_lock(&dri2_x11_invalidate_mutex);
+   dri2_surf->invalidate_next = dri2_x11_invalidate_surfaces;
+   dri2_x11_invalidate_surfaces = dri2_surf;
+   dri2_surf->invalidate_watched = true;
+   mtx_unlock(&dri2_x11_invalidate_mutex);
 }
 
 static void
-swrastPutImage(__DRIdrawable * draw, int op,
-               int x, int y, int w, int h,
-               char *data, void *loaderPrivate)
+dri2_x11_unwatch_invalidate(struct dri2_egl_surface *dri2_surf)
 {
-   struct dri2_egl_surface *dri2_surf = loaderPrivate;
-   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dri2_surf->base.Resource.Display);
-
-   xcb_gcontext_t gc;
+   struct dri2_egl_surface **link;
 
-   switch (op) {
-   case __DRI_SWRAST_IMAGE_OP_DRAW:
-      gc = dri2_surf->gc;
-      break;
-   case __DRI_SWRAST_IMAGE_OP_SWAP:
-      gc = dri2_surf->swapgc;
-      break;
-   default:
+   if (!dri2_surf->invalidate_watched)
       return;
-   }
 
-   xcb_put_image(dri2_dpy->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, dri2_surf->drawable,
-                 gc, w, h, x, y, 0, dri2_surf->depth,
-                 w*h*dri2_surf->bytes_per_pixel, (const uint8_t *)data);
+   mtx_lock(&dri2_x11_invalidate_mutex);
+   for (link = &dri2_x11_invalidate_surfaces; *link != dri2_surf;
+        link = &(*link)->invalidate_next)
+      ;
+   *link = dri2_surf->invalidate_next;
+   dri2_surf->invalidate_watched = false;
+   mtx_unlock(&dri2_x11_invalidate_mutex);
 }
 
-static void
-swrastGetImage(__DRIdrawable * read,
-               int x, int y, int w, int h,
-               char *data, void *loaderPrivate)
+/**
+ * Create the __DRIdrawable and the server-side state backing a surface.
+ *
+ * Window and pixmap surfaces are realized on first use (eglMakeCurrent,
+ * size queries, eglCopyBuffers, ...), as toolkits often create surfaces
+ * they never draw to.  Collecting the replies queued by
+ * dri2_x11_send_surface_requests costs at most one round trip.
+ */
+static EGLBoolean
+dri2_x11_realize_surface(_EGLDisplay *disp, struct dri2_egl_surface *dri2_surf)
 {
-   struct dri2_egl_surface *dri2_surf = loaderPrivate;
-   struct dri2_egl_display *dri2_dpy = dri2_egl_display(dri2_surf->base.Resource.Display);
-
-   xcb_get_image_cookie_t cookie;
-   xcb_get_image_reply_t *reply;
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+   EGLint type = dri2_surf->base.Type;
+   xcb_get_geometry_reply_t *reply;
    xcb_generic_error_t *error;
+   int conn_error;
 
-   cookie = xcb_get_image (dri2_dpy->conn, XCB_IMAGE_FORMAT_Z_PIXMAP,
-                           dri2_surf->drawable, x, y, w, h, ~0);
-   reply = xcb_get_image_reply (dri2_dpy->conn, cookie, &error);
-   if (reply == NULL)
-      return;
+   if (dri2_surf->dri_drawable)
+      return EGL_TRUE;
 
-   if (error != NULL) {
-      _eglLog(_EGL_WARNING, "error in xcb_get_image");
-      free(error);
+   if (!dri2_surf->requests_pending)
+      dri2_x11_send_surface_requests(dri2_dpy, dri2_surf);
+   dri2_surf->requests_pending = false;
+
+   if (type != EGL_PBUFFER_BIT) {
+      reply = xcb_get_geometry_reply (dri2_dpy->conn,
+                                      dri2_surf->geometry_cookie, &error);
+      if (error != NULL || reply == NULL) {
+         if (error == NULL || error->error_code == BadAlloc)
+            _eglError(EGL_BAD_ALLOC, "xcb_get_geometry");
+         else if (type == EGL_WINDOW_BIT)
+            _eglError(EGL_BAD_NATIVE_WINDOW, "xcb_get_geometry");
+         else
+            _eglError(EGL_BAD_NATIVE_PIXMAP, "xcb_get_geometry");
+         free(error);
+         free(reply);
+         /* Nothing will destroy the drawable later; a later realize
+          * starts over with a new DRI2CreateDrawable.
+          */
+         if (dri2_dpy->dri2)
+            dri2_x11_discard_create_drawable(dri2_dpy, dri2_surf);
+         if (dri2_x11_needs_window_attributes(dri2_dpy, dri2_surf))
+            xcb_discard_reply(dri2_dpy->conn,
+                              dri2_surf->attributes_cookie.sequence);
+         return EGL_FALSE;
+      }
+
+      dri2_surf->base.Width = reply->width;
+      dri2_surf->base.Height = reply->height;
+      dri2_surf->depth = reply->depth;
+      free(reply);
+   }
+
+   if (dri2_dpy->dri2) {
+      error = xcb_request_check(dri2_dpy->conn, dri2_surf->create_cookie);
+      conn_error = xcb_connection_has_error(dri2_dpy->conn);
+      if (conn_error || error != NULL) {
+         if (type == EGL_PBUFFER_BIT || conn_error || error->error_code == BadAlloc)
+            _eglError(EGL_BAD_ALLOC, "xcb_dri2_create_drawable_checked");
+         else if (type == EGL_WINDOW_BIT)
+            _eglError(EGL_BAD_NATIVE_WINDOW,
+                      "xcb_dri2_create_drawable_checked");
+         else
+            _eglError(EGL_BAD_NATIVE_PIXMAP,
+                      "xcb_dri2_create_drawable_checked");
+         free(error);
+         return EGL_FALSE;
+      }
+
+      dri2_surf->dri_drawable =
+	 (*dri2_dpy->dri2->createNewDrawable)(dri2_dpy->dri_screen,
+                                              dri2_surf->dri_config,
+					      dri2_surf);
    } else {
-      uint32_t bytes = (uint32_t) xcb_get_image_data_length(reply);
-      uint8_t *idata = xcb_get_image_data(reply);
-      memcpy(data, idata, bytes);
+      assert(dri2_dpy->swrast);
+      if (type == EGL_PBUFFER_BIT) {
+         dri2_surf->depth = _eglGetConfigKey(dri2_surf->base.Config,
+                                             EGL_BUFFER_SIZE);
+      }
+
+      /* Pixmaps keep their contents. Windows lose theirs when covered or
+       * unmapped unless the server keeps a backing store for them.
+       */
+      if (dri2_x11_needs_window_attributes(dri2_dpy, dri2_surf)) {
+         xcb_get_window_attributes_reply_t *attributes =
+            xcb_get_window_attributes_reply(dri2_dpy->conn,
+                                            dri2_surf->attributes_cookie,
+                                            NULL);
+
+         dri2_surf->tile_damage = attributes &&
+            attributes->backing_store == XCB_BACKING_STORE_ALWAYS;
+         free(attributes);
+      } else {
+         dri2_surf->tile_damage = dri2_dpy->tile_damage;
+      }
+      swrastCreateDrawable(dri2_dpy, dri2_surf);
+
+      dri2_surf->dri_drawable =
+         (*dri2_dpy->swrast->createNewDrawable)(dri2_dpy->dri_screen,
+                                                dri2_surf->dri_config,
+                                                dri2_surf);
    }
-   free(reply);
-}
 
+   if (dri2_surf->dri_drawable == NULL) {
+      _eglError(EGL_BAD_ALLOC, "dri2->createNewDrawable");
+      if (dri2_dpy->dri2)
+         xcb_dri2_destroy_drawable (dri2_dpy->conn, dri2_surf->drawable);
+      else
+         swrastDestroyDrawable(dri2_dpy, dri2_surf);
+      return EGL_FALSE;
+   }
 
-static xcb_screen_t *
-get_xcb_screen(xcb_screen_iterator_t iter, int screen)
-{
-    for (; iter.rem; --screen, xcb_screen_next(&iter))
-        if (screen == 0)
-            return iter.data;
+   if (dri2_dpy->dri2)
+      dri2_x11_watch_invalidate(dri2_dpy, dri2_surf);
 
-    return NULL;
-}
+   /* A new DRI2 drawable starts out with a swap interval of 1 on the server;
+    * apply whatever eglSwapInterval recorded while we were unrealized.
+    */
+   if (type == EGL_WINDOW_BIT && dri2_dpy->swap_available &&
+       dri2_surf->base.SwapInterval != 1)
+      xcb_dri2_swap_interval(dri2_dpy->conn, dri2_surf->drawable,
+                             dri2_surf->base.SwapInterval);
 
+   return EGL_TRUE;
+}
 
 /**
  * Called via eglCreateWindowSurface(), drv->API.CreateWindowSurface().
@@ -204,13 +2167,9 @@ dri2_x11_create_surface(_EGLDriver *drv, _EGLDisplay *disp, EGLint type,
    struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
    struct dri2_egl_config *dri2_conf = dri2_egl_config(conf);
    struct dri2_egl_surface *dri2_surf;
-   xcb_get_geometry_cookie_t cookie;
-   xcb_get_geometry_reply_t *reply;
    xcb_screen_iterator_t s;
-   xcb_generic_error_t *error;
    xcb_drawable_t drawable;
    xcb_screen_t *screen;
-   const __DRIconfig *config;
 
    STATIC_ASSERT(sizeof(uintptr_t) == sizeof(native_surface));
    drawable = (xcb_drawable_t) (uintptr_t) native_surface;
@@ -227,6 +2186,45 @@ dri2_x11_create_surface(_EGLDriver *drv, _EGLDisplay *disp, EGLint type,
       goto cleanup_surf;
 
    dri2_surf->region = XCB_NONE;
+   dri2_surf->region_width = dri2_surf->region_height = 0;
+   dri2_surf->swap_region = XCB_NONE;
+   dri2_surf->swap_rects = NULL;
+   dri2_surf->swap_rects_size = 0;
+   dri2_surf->copy_gc = XCB_NONE;
+   dri2_surf->sync_ust = dri2_surf->sync_msc = dri2_surf->sync_sbc = 0;
+   dri2_surf->sync_period = 0;
+   dri2_surf->sync_ret_ust = dri2_surf->sync_ret_msc = 0;
+   dri2_surf->sync_ret_sbc = dri2_surf->swap_sbc = 0;
+   dri2_surf->dri_drawable = NULL;
+   dri2_surf->requests_pending = false;
+   dri2_surf->shmid = -1;
+   dri2_surf->shm_addr = NULL;
+   dri2_surf->shm_size = 0;
+   dri2_surf->shm_busy = false;
+   dri2_surf->shm_batch = false;
+   dri2_surf->shm_offset = 0;
+   dri2_surf->dri_shmid = -1;
+   dri2_surf->swap_width = 0;
+   dri2_surf->swap_height = 0;
+   dri2_surf->damage_rects = NULL;
+   dri2_surf->n_damage_rects = 0;
+   dri2_surf->tile_hashes = NULL;
+   dri2_surf->tile_rects = NULL;
+   dri2_surf->tile_cols = dri2_surf->tile_rows = 0;
+   dri2_surf->tile_width = dri2_surf->tile_height = 0;
+   dri2_surf->tile_damage = false;
+   dri2_surf->dri_format = dri2_surf->server_format = SWRAST_FORMAT_NONE;
+   dri2_surf->convert_buf = NULL;
+   dri2_surf->convert_size = 0;
+   dri2_surf->swap_pending = false;
+   dri2_surf->invalidate_watched = false;
+   dri2_surf->presenter = NULL;
+   dri2_surf->present_buffers = NULL;
+   dri2_surf->present_sbc = dri2_surf->complete_sbc = 0;
+   dri2_surf->complete_msc = dri2_surf->complete_ust = 0;
+   dri2_surf->dri_config = dri2_get_dri_config(dri2_conf, type,
+                                               dri2_surf->base.GLColorspace);
+
    if (type == EGL_PBUFFER_BIT) {
       s = xcb_setup_roots_iterator(xcb_get_setup(dri2_dpy->conn));
       screen = get_xcb_screen(s, dri2_dpy->screen);
@@ -239,6 +2237,10 @@ dri2_x11_create_surface(_EGLDriver *drv, _EGLDisplay *disp, EGLint type,
       xcb_create_pixmap(dri2_dpy->conn, (uint8_t)conf->BufferSize,
                        dri2_surf->drawable, screen->root,
             (uint16_t)dri2_surf->base.Width,(uint16_t) dri2_surf->base.Height);
+
+      /* We own the pixmap, so there is nothing to gain from waiting. */
+      if (!dri2_x11_realize_surface(disp, dri2_surf))
+         goto cleanup_pixmap;
    } else {
       if (!drawable) {
          if (type == EGL_WINDOW_BIT)
@@ -248,75 +2250,7 @@ dri2_x11_create_surface(_EGLDriver *drv, _EGLDisplay *disp, EGLint type,
          goto cleanup_surf;
       }
       dri2_surf->drawable = drawable;
-   }
-
-   config = dri2_get_dri_config(dri2_conf, type,
-                                dri2_surf->base.GLColorspace);
-
-   if (dri2_dpy->dri2) {
-      dri2_surf->dri_drawable =
-	 (*dri2_dpy->dri2->createNewDrawable)(dri2_dpy->dri_screen, config,
-					      dri2_surf);
-   } else {
-      assert(dri2_dpy->swrast);
-      dri2_surf->dri_drawable = 
-         (*dri2_dpy->swrast->createNewDrawable)(dri2_dpy->dri_screen, config,
-                                                dri2_surf);
-   }
-
-   if (dri2_surf->dri_drawable == NULL) {
-      _eglError(EGL_BAD_ALLOC, "dri2->createNewDrawable");
-      goto cleanup_pixmap;
-   }
-
-   if (type != EGL_PBUFFER_BIT) {
-      cookie = xcb_get_geometry (dri2_dpy->conn, dri2_surf->drawable);
-      reply = xcb_get_geometry_reply (dri2_dpy->conn, cookie, &error);
-      if (error != NULL) {
-         if (error->error_code == BadAlloc)
-            _eglError(EGL_BAD_ALLOC, "xcb_get_geometry");
-         else if (type == EGL_WINDOW_BIT)
-            _eglError(EGL_BAD_NATIVE_WINDOW, "xcb_get_geometry");
-         else
-            _eglError(EGL_BAD_NATIVE_PIXMAP, "xcb_get_geometry");
-         free(error);
-         goto cleanup_dri_drawable;
-      } else if (reply == NULL) {
-         _eglError(EGL_BAD_ALLOC, "xcb_get_geometry");
-         goto cleanup_dri_drawable;
-      }
-
-      dri2_surf->base.Width = reply->width;
-      dri2_surf->base.Height = reply->height;
-      dri2_surf->depth = reply->depth;
-      free(reply);
-   }
-
-   if (dri2_dpy->dri2) {
-      xcb_void_cookie_t cookie;
-      int conn_error;
-
-      cookie = xcb_dri2_create_drawable_checked(dri2_dpy->conn,
-                                                dri2_surf->drawable);
-      error = xcb_request_check(dri2_dpy->conn, cookie);
-      conn_error = xcb_connection_has_error(dri2_dpy->conn);
-      if (conn_error || error != NULL) {
-         if (type == EGL_PBUFFER_BIT || conn_error || error->error_code == BadAlloc)
-            _eglError(EGL_BAD_ALLOC, "xcb_dri2_create_drawable_checked");
-         else if (type == EGL_WINDOW_BIT)
-            _eglError(EGL_BAD_NATIVE_WINDOW,
-                      "xcb_dri2_create_drawable_checked");
-         else
-            _eglError(EGL_BAD_NATIVE_PIXMAP,
-                      "xcb_dri2_create_drawable_checked");
-         free(error);
-         goto cleanup_dri_drawable;
-      }
-   } else {
-      if (type == EGL_PBUFFER_BIT) {
-         dri2_surf->depth = _eglGetConfigKey(conf, EGL_BUFFER_SIZE);
-      }
-      swrastCreateDrawable(dri2_dpy, dri2_surf);
+      dri2_x11_send_surface_requests(dri2_dpy, dri2_surf);
    }
 
    /* we always copy the back buffer to front */
@@ -324,11 +2258,8 @@ dri2_x11_create_surface(_EGLDriver *drv, _EGLDisplay *disp, EGLint type,
 
    return &dri2_surf->base;
 
- cleanup_dri_drawable:
-   dri2_dpy->core->destroyDrawable(dri2_surf->dri_drawable);
  cleanup_pixmap:
-   if (type == EGL_PBUFFER_BIT)
-      xcb_free_pixmap(dri2_dpy->conn, dri2_surf->drawable);
+   xcb_free_pixmap(dri2_dpy->conn, dri2_surf->drawable);
  cleanup_surf:
    free(dri2_surf);
 
@@ -386,18 +2317,37 @@ dri2_x11_destroy_surface(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *surf)
 
    (void) drv;
 
-   (*dri2_dpy->core->destroyDrawable)(dri2_surf->dri_drawable);
-   
-   if (dri2_dpy->dri2) {
-      xcb_dri2_destroy_drawable (dri2_dpy->conn, dri2_surf->drawable);
+   /* Surfaces that were never used have no DRI or server-side state. */
+   if (dri2_surf->dri_drawable) {
+      dri2_x11_unwatch_invalidate(dri2_surf);
+      (*dri2_dpy->core->destroyDrawable)(dri2_surf->dri_drawable);
+
+      if (dri2_dpy->dri2) {
+         if (dri2_surf->swap_pending)
+            xcb_discard_reply(dri2_dpy->conn,
+                              dri2_surf->swap_cookie.sequence);
+         if (dri2_surf->region != XCB_NONE)
+            xcb_xfixes_destroy_region(dri2_dpy->conn, dri2_surf->region);
+         if (dri2_surf->swap_region != XCB_NONE)
+            xcb_xfixes_destroy_region(dri2_dpy->conn, dri2_surf->swap_region);
+         if (dri2_surf->copy_gc != XCB_NONE)
+            xcb_free_gc(dri2_dpy->conn, dri2_surf->copy_gc);
+         xcb_dri2_destroy_drawable (dri2_dpy->conn, dri2_surf->drawable);
+      } else {
+         assert(dri2_dpy->swrast);
+         swrastDestroyDrawable(dri2_dpy, dri2_surf);
+      }
    } else {
-      assert(dri2_dpy->swrast);
-      swrastDestroyDrawable(dri2_dpy, dri2_surf);
+      dri2_x11_cancel_surface_requests(dri2_dpy, dri2_surf);
    }
 
    if (surf->Type == EGL_PBUFFER_BIT)
       xcb_free_pixmap (dri2_dpy->conn, dri2_surf->drawable);
 
+   free(dri2_surf->damage_rects);
+   free(dri2_surf->swap_rects);
+   free(dri2_surf->tile_hashes);
+   free(dri2_surf->tile_rects);
    free(surf);
 
    return EGL_TRUE;
@@ -418,6 +2368,7 @@ dri2_x11_process_buffers(struct dri2_egl_surface *dri2_surf,
    xcb_rectangle_t rectangle;
    unsigned i;
 
+   count = MIN2(count, ARRAY_SIZE(dri2_surf->buffers));
    dri2_surf->buffer_count = count;
    dri2_surf->have_fake_front = 0;
 
@@ -439,15 +2390,27 @@ dri2_x11_process_buffers(struct dri2_egl_surface *dri2_surf,
          dri2_surf->have_fake_front = 1;
    }
 
-   if (dri2_surf->region != XCB_NONE)
-      xcb_xfixes_destroy_region(dri2_dpy->conn, dri2_surf->region);
+   /* The buffers are requested again after every swap, but the drawable
+    * rarely changes size; only touch the full-surface region when it does.
+    */
+   if (dri2_surf->region != XCB_NONE &&
+       dri2_surf->region_width == dri2_surf->base.Width &&
+       dri2_surf->region_height == dri2_surf->base.Height)
+      return;
 
    rectangle.x = 0;
    rectangle.y = 0;
    rectangle.width = dri2_surf->base.Width;
    rectangle.height = dri2_surf->base.Height;
-   dri2_surf->region = xcb_generate_id(dri2_dpy->conn);
-   xcb_xfixes_create_region(dri2_dpy->conn, dri2_surf->region, 1, &rectangle);
+   if (dri2_surf->region == XCB_NONE) {
+      dri2_surf->region = xcb_generate_id(dri2_dpy->conn);
+      xcb_xfixes_create_region(dri2_dpy->conn, dri2_surf->region,
+                               1, &rectangle);
+   } else {
+      xcb_xfixes_set_region(dri2_dpy->conn, dri2_surf->region, 1, &rectangle);
+   }
+   dri2_surf->region_width = dri2_surf->base.Width;
+   dri2_surf->region_height = dri2_surf->base.Height;
 }
 
 static __DRIbuffer *
@@ -475,10 +2438,10 @@ dri2_x11_get_buffers(__DRIdrawable * driDrawable,
    if (buffers == NULL)
       return NULL;
 
-   *out_count = reply->count;
    dri2_surf->base.Width = *width = reply->width;
    dri2_surf->base.Height = *height = reply->height;
-   dri2_x11_process_buffers(dri2_surf, buffers, *out_count);
+   dri2_x11_process_buffers(dri2_surf, buffers, reply->count);
+   *out_count = dri2_surf->buffer_count;
 
    free(reply);
 
@@ -515,8 +2478,8 @@ dri2_x11_get_buffers_with_format(__DRIdrawable * driDrawable,
    buffers = xcb_dri2_get_buffers_with_format_buffers (reply);
    dri2_surf->base.Width = *width = reply->width;
    dri2_surf->base.Height = *height = reply->height;
-   *out_count = reply->count;
-   dri2_x11_process_buffers(dri2_surf, buffers, *out_count);
+   dri2_x11_process_buffers(dri2_surf, buffers, reply->count);
+   *out_count = dri2_surf->buffer_count;
 
    free(reply);
 
@@ -829,56 +2792,240 @@ dri2_copy_region(_EGLDriver *drv, _EGLDisplay *disp,
    return EGL_TRUE;
 }
 
+/**
+ * Collect the reply to the last DRI2 SwapBuffers, if any is outstanding.
+ * Returns false if that swap failed.
+ */
+static bool
+dri2_x11_reap_swap(struct dri2_egl_display *dri2_dpy,
+                   struct dri2_egl_surface *dri2_surf)
+{
+   xcb_dri2_swap_buffers_reply_t *reply;
+
+   if (!dri2_surf->swap_pending)
+      return true;
+
+   dri2_surf->swap_pending = false;
+   reply = xcb_dri2_swap_buffers_reply(dri2_dpy->conn, dri2_surf->swap_cookie,
+                                       NULL);
+   if (!reply)
+      return false;
+
+   dri2_surf->swap_sbc = ((int64_t) reply->swap_hi << 32) | reply->swap_lo;
+   free(reply);
+   return true;
+}
+
+/**
+ * Like dri2_x11_reap_swap, but only if the reply is already in, so it never
+ * waits on the server.
+ */
+static void
+dri2_x11_poll_swap(struct dri2_egl_display *dri2_dpy,
+                   struct dri2_egl_surface *dri2_surf)
+{
+   xcb_dri2_swap_buffers_reply_t *reply = NULL;
+   xcb_generic_error_t *error = NULL;
+
+   if (!dri2_surf->swap_pending ||
+       !xcb_poll_for_reply(dri2_dpy->conn, dri2_surf->swap_cookie.sequence,
+                           (void **) &reply, &error))
+      return;
+
+   dri2_surf->swap_pending = false;
+   if (reply)
+      dri2_surf->swap_sbc = ((int64_t) reply->swap_hi << 32) | reply->swap_lo;
+   free(reply);
+   free(error);
+}
+
+/**
+ * Send a DRI2 SwapBuffers for the surface without flushing the connection.
+ * Returns -1 on failure.
+ */
+static int64_t
+dri2_x11_queue_swap(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *draw,
+                    int64_t msc, int64_t divisor, int64_t remainder)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+   struct dri2_egl_surface *dri2_surf = dri2_egl_surface(draw);
+   uint32_t msc_hi = msc >> 32;
+   uint32_t msc_lo = msc & 0xffffffff;
+   uint32_t divisor_hi = divisor >> 32;
+   uint32_t divisor_lo = divisor & 0xffffffff;
+   uint32_t remainder_hi = remainder >> 32;
+   uint32_t remainder_lo = remainder & 0xffffffff;
+   int64_t ret = 0;
+
+   /* No-op for a pixmap or pbuffer surface */
+   if (draw->Type == EGL_PIXMAP_BIT || draw->Type == EGL_PBUFFER_BIT)
+      return 0;
+
+   /* eglSwapBuffersMultiMESA may name windows that were never current */
+   if (!dri2_x11_realize_surface(disp, dri2_surf))
+      return -1;
+
+   if (draw->SwapBehavior == EGL_BUFFER_PRESERVED || !dri2_dpy->swap_available)
+      return dri2_copy_region(drv, disp, draw, dri2_surf->region) ? 0 : -1;
+
+   dri2_flush_drawable_for_swapbuffers(disp, draw);
+
+   /* Nothing needs the swap count the reply carries, so leave it to arrive
+    * while the next frame is drawn instead of waiting a round trip for it
+    * here. The reply to the previous swap is normally already in by now;
+    * a failure shows up one swap late.
+    */
+   if (!dri2_x11_reap_swap(dri2_dpy, dri2_surf))
+      ret = -1;
+
+   dri2_surf->swap_cookie =
+      xcb_dri2_swap_buffers_unchecked(dri2_dpy->conn, dri2_surf->drawable,
+                                      msc_hi, msc_lo, divisor_hi, divisor_lo,
+                                      remainder_hi, remainder_lo);
+   dri2_surf->swap_pending = true;
+
+   /* Unless the server's invalidate events reach us through Xlib (see
+    * dri2_x11_hook_invalidate, and GLX may have replaced the hook since),
+    * XCB gives us no way to filter them out of the application's event
+    * queue. SwapBuffers is a common cause of
+    * invalidate events, so then just shove one down to the driver, even
+    * though we haven't told the driver that we're the kind of loader that
+    * provides reliable invalidate events.  This causes the driver to
+    * request buffers again at its next draw, so that we get the correct
+    * buffers if a pageflip happened.  The driver should still be using the
+    * viewport hack to catch window resizes.
+    */
+   if (dri2_dpy->flush && dri2_dpy->flush->base.version >= 3 &&
+       dri2_dpy->flush->invalidate &&
+       !(dri2_dpy->invalidate_hook &&
+         dri2_x11_hook_installed(dri2_dpy->invalidate_hook)))
+      (*dri2_dpy->flush->invalidate)(dri2_surf->dri_drawable);
+
+   return ret;
+}
+
 static int64_t
 dri2_x11_swap_buffers_msc(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *draw,
                           int64_t msc, int64_t divisor, int64_t remainder)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+   int64_t ret;
+
+   ret = dri2_x11_queue_swap(drv, disp, draw, msc, divisor, remainder);
+   xcb_flush(dri2_dpy->conn);
+
+   return ret;
+}
+
+/**
+ * Swap several windows with a single flush of the connection. Each reply
+ * is left to arrive as with a single swap, so a batch costs about as much
+ * server traffic as one eglSwapBuffers. Damage is ignored, as it is for
+ * one DRI2 swap.
+ *
+ * The driver is still flushed once per window: flush_with_flags is the
+ * only way to resolve a drawable for presentation and it always flushes
+ * the context with it. Only the first of those flushes has work to
+ * submit.
+ */
+static EGLBoolean
+dri2_x11_swap_buffers_multi(_EGLDriver *drv, _EGLDisplay *disp,
+                            EGLint n_surfaces, _EGLSurface **surfaces,
+                            const EGLint *const *rects, const EGLint *n_rects)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+   EGLBoolean ret = EGL_TRUE;
+   EGLint i;
+
+   (void) rects;
+   (void) n_rects;
+
+   for (i = 0; i < n_surfaces; i++) {
+      if (dri2_x11_queue_swap(drv, disp, surfaces[i], 0, 0, 0) == -1)
+         ret = EGL_FALSE;
+   }
+   xcb_flush(dri2_dpy->conn);
+
+   if (!ret)
+      _eglError(EGL_BAD_NATIVE_WINDOW, __FUNCTION__);
+
+   return ret;
+}
+
+/**
+ * Upload only the given rectangles of the swrast back buffer. The rects use
+ * the EGL lower-left origin, which is also what copySubBuffer expects.
+ * With no rectangles, or a driver that cannot copy sub-buffers, the whole
+ * frame is presented.
+ */
+static EGLBoolean
+dri2_x11_swrast_present_rects(_EGLDisplay *disp, _EGLSurface *draw,
+                              const EGLint *rects, EGLint n_rects)
 {
    struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
    struct dri2_egl_surface *dri2_surf = dri2_egl_surface(draw);
-   uint32_t msc_hi = msc >> 32;
-   uint32_t msc_lo = msc & 0xffffffff;
-   uint32_t divisor_hi = divisor >> 32;
-   uint32_t divisor_lo = divisor & 0xffffffff;
-   uint32_t remainder_hi = remainder >> 32;
-   uint32_t remainder_lo = remainder & 0xffffffff;
-   xcb_dri2_swap_buffers_cookie_t cookie;
-   xcb_dri2_swap_buffers_reply_t *reply;
-   int64_t swap_count = -1;
+   int i;
 
-   /* No-op for a pixmap or pbuffer surface */
-   if (draw->Type == EGL_PIXMAP_BIT || draw->Type == EGL_PBUFFER_BIT)
-      return 0;
+   if (!dri2_x11_realize_surface(disp, dri2_surf))
+      return EGL_FALSE;
 
-   if (draw->SwapBehavior == EGL_BUFFER_PRESERVED || !dri2_dpy->swap_available)
-      return dri2_copy_region(drv, disp, draw, dri2_surf->region) ? 0 : -1;
+   if (n_rects == 0 || !dri2_dpy->copy_sub_buffer) {
+      dri2_dpy->core->swapBuffers(dri2_surf->dri_drawable);
+      return EGL_TRUE;
+   }
 
-   dri2_flush_drawable_for_swapbuffers(disp, draw);
+   /* Each rect comes back through swrastPutImage2; pack them all into the
+    * staging segment instead of waiting for the server after every one.
+    */
+   if (n_rects > 1 && !dri2_surf->presenter) {
+      bool convert = !swrastFormatsCompatible(dri2_surf->dri_format,
+                                              dri2_surf->server_format);
+      size_t size = 0;
+
+      for (i = 0; i < n_rects; i++)
+         size += swrastShmBlockSize(dri2_surf, convert,
+                                    CLAMP(rects[i * 4 + 2], 0, draw->Width),
+                                    CLAMP(rects[i * 4 + 3], 0, draw->Height));
+      swrastShmBeginBatch(dri2_dpy, dri2_surf, size);
+   }
 
-   cookie = xcb_dri2_swap_buffers_unchecked(dri2_dpy->conn, dri2_surf->drawable,
-                  msc_hi, msc_lo, divisor_hi, divisor_lo, remainder_hi, remainder_lo);
+   for (i = 0; i < n_rects; i++) {
+      const EGLint *rect = &rects[i * 4];
+      int x0 = MAX2(rect[0], 0);
+      int y0 = MAX2(rect[1], 0);
+      int x1 = MIN2(rect[0] + rect[2], draw->Width);
+      int y1 = MIN2(rect[1] + rect[3], draw->Height);
 
-   reply = xcb_dri2_swap_buffers_reply(dri2_dpy->conn, cookie, NULL);
+      if (x1 <= x0 || y1 <= y0)
+         continue;
 
-   if (reply) {
-      swap_count = (((int64_t)reply->swap_hi) << 32) | reply->swap_lo;
-      free(reply);
+      dri2_dpy->copy_sub_buffer->copySubBuffer(dri2_surf->dri_drawable,
+                                               x0, y0, x1 - x0, y1 - y0);
    }
 
-   /* Since we aren't watching for the server's invalidate events like we're
-    * supposed to (due to XCB providing no mechanism for filtering the events
-    * the way xlib does), and SwapBuffers is a common cause of invalidate
-    * events, just shove one down to the driver, even though we haven't told
-    * the driver that we're the kind of loader that provides reliable
-    * invalidate events.  This causes the driver to request buffers again at
-    * its next draw, so that we get the correct buffers if a pageflip
-    * happened.  The driver should still be using the viewport hack to catch
-    * window resizes.
-    */
-   if (dri2_dpy->flush &&
-       dri2_dpy->flush->base.version >= 3 && dri2_dpy->flush->invalidate)
-      (*dri2_dpy->flush->invalidate)(dri2_surf->dri_drawable);
+   swrastShmEndBatch(dri2_dpy, dri2_surf);
+   return EGL_TRUE;
+}
+
+/**
+ * Frame boundary bookkeeping for swrast swaps: the back buffer now holds
+ * the frame on screen, and any partial update damage region has expired.
+ */
+static void
+dri2_x11_swrast_end_frame(struct dri2_egl_display *dri2_dpy,
+                          struct dri2_egl_surface *dri2_surf)
+{
+   dri2_surf->swap_width = dri2_surf->base.Width;
+   dri2_surf->swap_height = dri2_surf->base.Height;
+
+   if (dri2_surf->n_damage_rects == 0)
+      return;
 
-   return swap_count;
+   dri2_surf->n_damage_rects = 0;
+#ifdef __DRI2_DAMAGE
+   if (dri2_dpy->damage)
+      dri2_dpy->damage->set_damage_region(dri2_surf->dri_drawable, 0, NULL);
+#endif
 }
 
 static EGLBoolean
@@ -897,11 +3044,93 @@ dri2_x11_swap_buffers(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *draw)
    } else {
       assert(dri2_dpy->swrast);
 
-      dri2_dpy->core->swapBuffers(dri2_surf->dri_drawable);
+      if (!dri2_x11_realize_surface(disp, dri2_surf)) {
+         _eglError(EGL_BAD_NATIVE_WINDOW, __FUNCTION__);
+         return EGL_FALSE;
+      }
+
+      /* With EGL_KHR_partial_update everything outside the damage region
+       * still holds the previous frame, which is what is on screen, unless
+       * the back buffer was reallocated since.
+       */
+      if (dri2_surf->n_damage_rects > 0 &&
+          dri2_surf->swap_width == draw->Width &&
+          dri2_surf->swap_height == draw->Height)
+         dri2_x11_swrast_present_rects(disp, draw, dri2_surf->damage_rects,
+                                       dri2_surf->n_damage_rects);
+      else
+         dri2_dpy->core->swapBuffers(dri2_surf->dri_drawable);
+
+      dri2_x11_swrast_end_frame(dri2_dpy, dri2_surf);
       return EGL_TRUE;
    }
 }
 
+/* Past this many rectangles a region swap copies their bounding box, and
+ * once they cover three quarters of the surface, all of it; the server
+ * walks every rectangle, and one large blit beats many small ones.
+ */
+#define DRI2_SWAP_REGION_MAX_RECTS 64
+
+/* Coalescing is quadratic, so larger lists go straight to the bounding box. */
+#define DRI2_SWAP_REGION_COALESCE_LIMIT 512
+
+static void
+dri2_x11_rect_union(xcb_rectangle_t *a, const xcb_rectangle_t *b)
+{
+   int x1 = MAX2(a->x + a->width, b->x + b->width);
+   int y1 = MAX2(a->y + a->height, b->y + b->height);
+
+   a->x = MIN2(a->x, b->x);
+   a->y = MIN2(a->y, b->y);
+   a->width = x1 - a->x;
+   a->height = y1 - a->y;
+}
+
+/**
+ * Merge b into a when their union covers nothing but the two: one holds
+ * the other, or they line up along an edge and touch or overlap.
+ */
+static bool
+dri2_x11_merge_rect(xcb_rectangle_t *a, const xcb_rectangle_t *b)
+{
+   int ax1 = a->x + a->width, ay1 = a->y + a->height;
+   int bx1 = b->x + b->width, by1 = b->y + b->height;
+
+   if ((a->x <= b->x && a->y <= b->y && bx1 <= ax1 && by1 <= ay1) ||
+       (b->x <= a->x && b->y <= a->y && ax1 <= bx1 && ay1 <= by1) ||
+       (a->x == b->x && ax1 == bx1 && b->y <= ay1 && a->y <= by1) ||
+       (a->y == b->y && ay1 == by1 && b->x <= ax1 && a->x <= bx1)) {
+      dri2_x11_rect_union(a, b);
+      return true;
+   }
+
+   return false;
+}
+
+static int
+dri2_x11_coalesce_rects(xcb_rectangle_t *rects, int n)
+{
+   bool merged;
+   int i, j;
+
+   do {
+      merged = false;
+      for (i = 0; i < n; i++) {
+         for (j = i + 1; j < n; j++) {
+            if (dri2_x11_merge_rect(&rects[i], &rects[j])) {
+               /* rects[i] grew; check it against everything again */
+               rects[j] = rects[--n];
+               j = i;
+               merged = true;
+            }
+         }
+      }
+   } while (merged);
+
+   return n;
+}
+
 static EGLBoolean
 dri2_x11_swap_buffers_region(_EGLDriver *drv, _EGLDisplay *disp,
                              _EGLSurface *draw,
@@ -909,27 +3138,63 @@ dri2_x11_swap_buffers_region(_EGLDriver *drv, _EGLDisplay *disp,
 {
    struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
    struct dri2_egl_surface *dri2_surf = dri2_egl_surface(draw);
-   EGLBoolean ret;
-   xcb_xfixes_region_t region;
-   xcb_rectangle_t rectangles[16];
-   int i;
-
-   if (numRects > (int)ARRAY_SIZE(rectangles))
-      return dri2_copy_region(drv, disp, draw, dri2_surf->region);
+   int64_t area = (int64_t) draw->Width * draw->Height;
+   int64_t covered = 0;
+   xcb_rectangle_t *rectangles;
+   int i, n = 0;
+
+   if (numRects > dri2_surf->swap_rects_size) {
+      rectangles = realloc(dri2_surf->swap_rects,
+                           numRects * sizeof(*rectangles));
+      if (!rectangles)
+         return dri2_copy_region(drv, disp, draw, dri2_surf->region);
+      dri2_surf->swap_rects = rectangles;
+      dri2_surf->swap_rects_size = numRects;
+   }
+   rectangles = dri2_surf->swap_rects;
 
+   /* Flip to X's top-left origin and clip, dropping empty rectangles. */
    for (i = 0; i < numRects; i++) {
-      rectangles[i].x = rects[i * 4];
-      rectangles[i].y = dri2_surf->base.Height - rects[i * 4 + 1] - rects[i * 4 + 3];
-      rectangles[i].width = rects[i * 4 + 2];
-      rectangles[i].height = rects[i * 4 + 3];
+      const EGLint *rect = &rects[i * 4];
+      int x0 = MAX2(rect[0], 0);
+      int x1 = MIN2(rect[0] + rect[2], draw->Width);
+      int y0 = MAX2(draw->Height - rect[1] - rect[3], 0);
+      int y1 = MIN2(draw->Height - rect[1], draw->Height);
+
+      if (x0 >= x1 || y0 >= y1)
+         continue;
+
+      rectangles[n].x = x0;
+      rectangles[n].y = y0;
+      rectangles[n].width = x1 - x0;
+      rectangles[n].height = y1 - y0;
+      n++;
    }
 
-   region = xcb_generate_id(dri2_dpy->conn);
-   xcb_xfixes_create_region(dri2_dpy->conn, region, numRects, rectangles);
-   ret = dri2_copy_region(drv, disp, draw, region);
-   xcb_xfixes_destroy_region(dri2_dpy->conn, region);
+   if (n <= DRI2_SWAP_REGION_COALESCE_LIMIT)
+      n = dri2_x11_coalesce_rects(rectangles, n);
 
-   return ret;
+   if (n > DRI2_SWAP_REGION_MAX_RECTS) {
+      for (i = 1; i < n; i++)
+         dri2_x11_rect_union(&rectangles[0], &rectangles[i]);
+      n = 1;
+   }
+
+   for (i = 0; i < n; i++)
+      covered += (int64_t) rectangles[i].width * rectangles[i].height;
+   if (covered * 4 >= area * 3)
+      return dri2_copy_region(drv, disp, draw, dri2_surf->region);
+
+   if (dri2_surf->swap_region == XCB_NONE) {
+      dri2_surf->swap_region = xcb_generate_id(dri2_dpy->conn);
+      xcb_xfixes_create_region(dri2_dpy->conn, dri2_surf->swap_region,
+                               n, rectangles);
+   } else {
+      xcb_xfixes_set_region(dri2_dpy->conn, dri2_surf->swap_region,
+                            n, rectangles);
+   }
+
+   return dri2_copy_region(drv, disp, draw, dri2_surf->swap_region);
 }
 
 static EGLBoolean
@@ -944,6 +3209,107 @@ dri2_x11_post_sub_buffer(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *draw,
    return dri2_x11_swap_buffers_region(drv, disp, draw, 1, rect);
 }
 
+static EGLBoolean
+dri2_x11_swrast_swap_buffers_with_damage(_EGLDriver *drv, _EGLDisplay *disp,
+                                         _EGLSurface *draw,
+                                         const EGLint *rects, EGLint n_rects)
+{
+   struct dri2_egl_surface *dri2_surf = dri2_egl_surface(draw);
+
+   if (!dri2_x11_swrast_present_rects(disp, draw, rects, n_rects))
+      return EGL_FALSE;
+
+   dri2_x11_swrast_end_frame(dri2_egl_display(disp), dri2_surf);
+   return EGL_TRUE;
+}
+
+/**
+ * Remember the damage region of the frame being drawn: the swap uploads
+ * just that, and a driver that supports it limits rendering to it.
+ */
+static EGLBoolean
+dri2_x11_swrast_set_damage_region(_EGLDriver *drv, _EGLDisplay *disp,
+                                  _EGLSurface *surf,
+                                  const EGLint *rects, EGLint n_rects)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+   struct dri2_egl_surface *dri2_surf = dri2_egl_surface(surf);
+
+   if (n_rects > 0) {
+      EGLint *copy = realloc(dri2_surf->damage_rects,
+                             n_rects * 4 * sizeof(EGLint));
+      if (!copy)
+         return _eglError(EGL_BAD_ALLOC, "eglSetDamageRegionKHR");
+
+      memcpy(copy, rects, n_rects * 4 * sizeof(EGLint));
+      dri2_surf->damage_rects = copy;
+   }
+   dri2_surf->n_damage_rects = n_rects;
+
+#ifdef __DRI2_DAMAGE
+   if (dri2_dpy->damage && dri2_surf->dri_drawable)
+      dri2_dpy->damage->set_damage_region(dri2_surf->dri_drawable, n_rects,
+                                          (int *) dri2_surf->damage_rects);
+#else
+   (void) dri2_dpy;
+#endif
+
+   return EGL_TRUE;
+}
+
+/**
+ * The swrast driver keeps a single back buffer and presents by copying it
+ * out, so after a swap it still holds the frame just shown. That makes its
+ * age 1, until a resize makes the driver reallocate it.
+ */
+static EGLint
+dri2_x11_swrast_query_buffer_age(_EGLDriver *drv, _EGLDisplay *disp,
+                                 _EGLSurface *surf)
+{
+   struct dri2_egl_surface *dri2_surf = dri2_egl_surface(surf);
+   int x, y, w, h;
+
+   if (dri2_surf->swap_width == 0 || !dri2_surf->dri_drawable)
+      return 0;
+
+   swrastGetDrawableInfo(dri2_surf->dri_drawable, &x, &y, &w, &h, dri2_surf);
+   if (w != dri2_surf->swap_width || h != dri2_surf->swap_height)
+      return 0;
+
+   return 1;
+}
+
+static EGLBoolean
+dri2_x11_swrast_swap_buffers_region(_EGLDriver *drv, _EGLDisplay *disp,
+                                    _EGLSurface *draw,
+                                    EGLint numRects, const EGLint *rects)
+{
+   struct dri2_egl_surface *dri2_surf = dri2_egl_surface(draw);
+
+   /* an empty region posts nothing, unlike an empty damage list, but it
+    * still ends the frame
+    */
+   if (numRects != 0 &&
+       !dri2_x11_swrast_present_rects(disp, draw, rects, numRects))
+      return EGL_FALSE;
+
+   dri2_x11_swrast_end_frame(dri2_egl_display(disp), dri2_surf);
+   return EGL_TRUE;
+}
+
+static EGLBoolean
+dri2_x11_swrast_post_sub_buffer(_EGLDriver *drv, _EGLDisplay *disp,
+                                _EGLSurface *draw,
+                                EGLint x, EGLint y, EGLint width, EGLint height)
+{
+   const EGLint rect[4] = { x, y, width, height };
+
+   if (x < 0 || y < 0 || width < 0 || height < 0)
+      return _eglError(EGL_BAD_PARAMETER, "eglPostSubBufferNV");
+
+   return dri2_x11_swrast_swap_buffers_region(drv, disp, draw, 1, rect);
+}
+
 static EGLBoolean
 dri2_x11_swap_interval(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *surf,
                        EGLint interval)
@@ -956,7 +3322,9 @@ dri2_x11_swap_interval(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *surf,
    else if (interval < surf->Config->MinSwapInterval)
       interval = surf->Config->MinSwapInterval;
 
-   if (interval != surf->SwapInterval && dri2_dpy->swap_available)
+   /* Unrealized surfaces send theirs from dri2_x11_realize_surface. */
+   if (interval != surf->SwapInterval && dri2_dpy->swap_available &&
+       dri2_surf->dri_drawable)
       xcb_dri2_swap_interval(dri2_dpy->conn, dri2_surf->drawable, interval);
 
    surf->SwapInterval = interval;
@@ -978,10 +3346,29 @@ dri2_x11_copy_buffers(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *surf,
 
    (void) drv;
 
+   if (!dri2_x11_realize_surface(disp, dri2_surf))
+      return EGL_FALSE;
+
    (*dri2_dpy->flush->flush)(dri2_surf->dri_drawable);
 
-   gc = xcb_generate_id(dri2_dpy->conn);
-   xcb_create_gc(dri2_dpy->conn, gc, target, 0, NULL);
+   /* CopyArea needs the target to share the surface's depth and screen, so
+    * one GC made on the surface drawable serves every valid target. Turn
+    * off graphics exposures so per-frame captures don't queue NoExpose.
+    */
+   if (dri2_dpy->swrast) {
+      swrastPresenterDrain(dri2_surf);
+      gc = dri2_surf->swapgc;
+   } else {
+      if (dri2_surf->copy_gc == XCB_NONE) {
+         const uint32_t exposures = 0;
+
+         dri2_surf->copy_gc = xcb_generate_id(dri2_dpy->conn);
+         xcb_create_gc(dri2_dpy->conn, dri2_surf->copy_gc, dri2_surf->drawable,
+                       XCB_GC_GRAPHICS_EXPOSURES, &exposures);
+      }
+      gc = dri2_surf->copy_gc;
+   }
+
    xcb_copy_area(dri2_dpy->conn,
 		  dri2_surf->drawable,
 		  target,
@@ -990,7 +3377,6 @@ dri2_x11_copy_buffers(_EGLDriver *drv, _EGLDisplay *disp, _EGLSurface *surf,
 		  0, 0,
 		  dri2_surf->base.Width,
 		  dri2_surf->base.Height);
-   xcb_free_gc(dri2_dpy->conn, gc);
 
    return EGL_TRUE;
 }
@@ -1103,6 +3489,47 @@ dri2_x11_create_image_khr(_EGLDriver *drv, _EGLDisplay *disp,
    }
 }
 
+/**
+ * Estimate the sync values from the last GetMSC reply instead of asking the
+ * server again, as long as that reply is younger than the configured age
+ * and a refresh period has been measured. Like the server, this takes UST
+ * to be CLOCK_MONOTONIC in microseconds.
+ *
+ * MSC advances by one per elapsed period. SBC assumes each swap sent since
+ * the reply completed as early as the swap interval allows, which never
+ * counts more swaps than were actually sent.
+ */
+static bool
+dri2_x11_extrapolate_sync_values(struct dri2_egl_display *dri2_dpy,
+                                 struct dri2_egl_surface *dri2_surf,
+                                 int64_t *ust, int64_t *msc, int64_t *sbc)
+{
+   int64_t interval = dri2_surf->base.SwapInterval;
+   struct timespec now;
+   int64_t now_us, frames;
+
+   if (!dri2_dpy->sync_values_max_age || !dri2_surf->sync_ust ||
+       !dri2_surf->sync_period)
+      return false;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   now_us = (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+   if (now_us < dri2_surf->sync_ust ||
+       now_us - dri2_surf->sync_ust > dri2_dpy->sync_values_max_age)
+      return false;
+
+   frames = (now_us - dri2_surf->sync_ust) / dri2_surf->sync_period;
+   *ust = dri2_surf->sync_ust + frames * dri2_surf->sync_period;
+   *msc = dri2_surf->sync_msc + frames;
+   if (interval > 0)
+      *sbc = MIN2(dri2_surf->sync_sbc + frames / interval, dri2_surf->swap_sbc);
+   else
+      *sbc = dri2_surf->swap_sbc;
+   *sbc = MAX2(*sbc, dri2_surf->sync_sbc);
+
+   return true;
+}
+
 static EGLBoolean
 dri2_x11_get_sync_values(_EGLDisplay *display, _EGLSurface *surface,
                          EGLuint64KHR *ust, EGLuint64KHR *msc,
@@ -1112,7 +3539,24 @@ dri2_x11_get_sync_values(_EGLDisplay *display, _EGLSurface *surface,
    struct dri2_egl_surface *dri2_surf = dri2_egl_surface(surface);
    xcb_dri2_get_msc_cookie_t cookie;
    xcb_dri2_get_msc_reply_t *reply;
+   int64_t new_ust, new_msc, new_sbc;
+
+   /* GetMSC needs the server-side DRI2 drawable */
+   if (!dri2_x11_realize_surface(display, dri2_surf))
+      return EGL_FALSE;
+
+   /* An estimate must not wait on the server, so only take the swap's
+    * reply if it is already in.
+    */
+   dri2_x11_poll_swap(dri2_dpy, dri2_surf);
+   if (dri2_x11_extrapolate_sync_values(dri2_dpy, dri2_surf,
+                                        &new_ust, &new_msc, &new_sbc))
+      goto out;
 
+   /* The swap was sent before GetMSC, so its reply comes first and waiting
+    * for it adds no round trip of its own.
+    */
+   dri2_x11_reap_swap(dri2_dpy, dri2_surf);
    cookie = xcb_dri2_get_msc(dri2_dpy->conn, dri2_surf->drawable);
    reply = xcb_dri2_get_msc_reply(dri2_dpy->conn, cookie, NULL);
 
@@ -1121,30 +3565,126 @@ dri2_x11_get_sync_values(_EGLDisplay *display, _EGLSurface *surface,
       return EGL_FALSE;
    }
 
-   *ust = ((EGLuint64KHR) reply->ust_hi << 32) | reply->ust_lo;
-   *msc = ((EGLuint64KHR) reply->msc_hi << 32) | reply->msc_lo;
-   *sbc = ((EGLuint64KHR) reply->sbc_hi << 32) | reply->sbc_lo;
+   new_ust = ((int64_t) reply->ust_hi << 32) | reply->ust_lo;
+   new_msc = ((int64_t) reply->msc_hi << 32) | reply->msc_lo;
+   new_sbc = ((int64_t) reply->sbc_hi << 32) | reply->sbc_lo;
    free(reply);
 
+   if (dri2_surf->sync_ust && new_ust > dri2_surf->sync_ust &&
+       new_msc > dri2_surf->sync_msc)
+      dri2_surf->sync_period = (new_ust - dri2_surf->sync_ust) /
+                               (new_msc - dri2_surf->sync_msc);
+   dri2_surf->sync_ust = new_ust;
+   dri2_surf->sync_msc = new_msc;
+   dri2_surf->sync_sbc = new_sbc;
+
+out:
+   /* An estimate may have run ahead of what the server now reports; the
+    * counters must not go backwards, so hold them until it catches up.
+    */
+   if (new_msc < dri2_surf->sync_ret_msc) {
+      new_msc = dri2_surf->sync_ret_msc;
+      new_ust = dri2_surf->sync_ret_ust;
+   }
+   new_sbc = MAX2(new_sbc, dri2_surf->sync_ret_sbc);
+
+   *ust = dri2_surf->sync_ret_ust = new_ust;
+   *msc = dri2_surf->sync_ret_msc = new_msc;
+   *sbc = dri2_surf->sync_ret_sbc = new_sbc;
+
+   return EGL_TRUE;
+}
+
+/**
+ * Timing of the last frame Present reported on screen.
+ */
+static EGLBoolean
+dri2_x11_swrast_get_sync_values(_EGLDisplay *display, _EGLSurface *surface,
+                                EGLuint64KHR *ust, EGLuint64KHR *msc,
+                                EGLuint64KHR *sbc)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(display);
+   struct dri2_egl_surface *dri2_surf = dri2_egl_surface(surface);
+
+   if (!dri2_x11_realize_surface(display, dri2_surf))
+      return EGL_FALSE;
+
+   if (!dri2_surf->present_buffers)
+      return _eglError(EGL_BAD_ACCESS, __func__);
+
+   swrastProcessEvents(dri2_dpy, dri2_surf);
+   *ust = dri2_surf->complete_ust;
+   *msc = dri2_surf->complete_msc;
+   *sbc = dri2_surf->complete_sbc;
+
    return EGL_TRUE;
 }
 
+static EGLBoolean
+dri2_x11_swrast_add_configs(_EGLDriver *drv, _EGLDisplay *disp)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+
+   (void) drv;
+
+   return dri2_x11_add_configs_for_visuals(dri2_dpy, disp, true);
+}
+
+static __DRIdrawable *
+dri2_x11_get_dri_drawable(_EGLSurface *surf)
+{
+   struct dri2_egl_surface *dri2_surf = dri2_egl_surface(surf);
+
+   if (!dri2_x11_realize_surface(surf->Resource.Display, dri2_surf))
+      return NULL;
+
+   return dri2_surf->dri_drawable;
+}
+
+static EGLBoolean
+dri2_x11_query_surface(_EGLDriver *drv, _EGLDisplay *disp,
+                       _EGLSurface *surf, EGLint attribute, EGLint *value)
+{
+   struct dri2_egl_display *dri2_dpy = dri2_egl_display(disp);
+   struct dri2_egl_surface *dri2_surf = dri2_egl_surface(surf);
+
+   /* The size of a window or pixmap is only known once realized. */
+   switch (attribute) {
+   case EGL_WIDTH:
+   case EGL_HEIGHT:
+      if (!dri2_x11_realize_surface(disp, dri2_surf))
+         return EGL_FALSE;
+      if (dri2_dpy->swrast)
+         swrastProcessEvents(dri2_dpy, dri2_surf);
+      break;
+   default:
+      break;
+   }
+
+   return _eglQuerySurface(drv, disp, surf, attribute, value);
+}
+
 static struct dri2_egl_display_vtbl dri2_x11_swrast_display_vtbl = {
    .authenticate = NULL,
+   .add_configs = dri2_x11_swrast_add_configs,
    .create_window_surface = dri2_x11_create_window_surface,
    .create_pixmap_surface = dri2_x11_create_pixmap_surface,
    .create_pbuffer_surface = dri2_x11_create_pbuffer_surface,
    .destroy_surface = dri2_x11_destroy_surface,
    .create_image = dri2_fallback_create_image_khr,
-   .swap_interval = dri2_fallback_swap_interval,
+   .swap_interval = dri2_x11_swap_interval,
    .swap_buffers = dri2_x11_swap_buffers,
-   .swap_buffers_region = dri2_fallback_swap_buffers_region,
-   .post_sub_buffer = dri2_fallback_post_sub_buffer,
+   .swap_buffers_with_damage = dri2_x11_swrast_swap_buffers_with_damage,
+   .swap_buffers_region = dri2_x11_swrast_swap_buffers_region,
+   .swap_buffers_multi = dri2_fallback_swap_buffers_multi,
+   .post_sub_buffer = dri2_x11_swrast_post_sub_buffer,
    .copy_buffers = dri2_x11_copy_buffers,
-   .query_buffer_age = dri2_fallback_query_buffer_age,
+   .query_buffer_age = dri2_x11_swrast_query_buffer_age,
+   .set_damage_region = dri2_x11_swrast_set_damage_region,
    .create_wayland_buffer_from_image = dri2_fallback_create_wayland_buffer_from_image,
-   .get_sync_values = dri2_fallback_get_sync_values,
-   .get_dri_drawable = dri2_surface_get_dri_drawable,
+   .get_sync_values = dri2_x11_swrast_get_sync_values,
+   .query_surface = dri2_x11_query_surface,
+   .get_dri_drawable = dri2_x11_get_dri_drawable,
 };
 
 static struct dri2_egl_display_vtbl dri2_x11_display_vtbl = {
@@ -1158,20 +3698,38 @@ static struct dri2_egl_display_vtbl dri2_x11_display_vtbl = {
    .swap_buffers = dri2_x11_swap_buffers,
    .swap_buffers_with_damage = dri2_fallback_swap_buffers_with_damage,
    .swap_buffers_region = dri2_x11_swap_buffers_region,
+   .swap_buffers_multi = dri2_x11_swap_buffers_multi,
    .post_sub_buffer = dri2_x11_post_sub_buffer,
    .copy_buffers = dri2_x11_copy_buffers,
    .query_buffer_age = dri2_fallback_query_buffer_age,
+   .set_damage_region = dri2_fallback_set_damage_region,
    .create_wayland_buffer_from_image = dri2_fallback_create_wayland_buffer_from_image,
    .get_sync_values = dri2_x11_get_sync_values,
-   .get_dri_drawable = dri2_surface_get_dri_drawable,
+   .query_surface = dri2_x11_query_surface,
+   .get_dri_drawable = dri2_x11_get_dri_drawable,
 };
 
 static const __DRIswrastLoaderExtension swrast_loader_extension = {
-   .base = { __DRI_SWRAST_LOADER, 1 },
+   .base = { __DRI_SWRAST_LOADER, 4 },
+
+   .getDrawableInfo = swrastGetDrawableInfo,
+   .putImage        = swrastPutImage,
+   .getImage        = swrastGetImage,
+   .putImage2       = swrastPutImage2,
+   .getImage2       = swrastGetImage2,
+   .putImageShm     = swrastPutImageShm,
+   .getImageShm     = swrastGetImageShm,
+};
+
+/* Without MIT-SHM the driver must not allocate shared memory targets. */
+static const __DRIswrastLoaderExtension swrast_loader_noshm_extension = {
+   .base = { __DRI_SWRAST_LOADER, 3 },
 
    .getDrawableInfo = swrastGetDrawableInfo,
    .putImage        = swrastPutImage,
    .getImage        = swrastGetImage,
+   .putImage2       = swrastPutImage2,
+   .getImage2       = swrastGetImage2,
 };
 
 static const __DRIextension *swrast_loader_extensions[] = {
@@ -1179,11 +3737,70 @@ static const __DRIextension *swrast_loader_extensions[] = {
    NULL,
 };
 
+static const __DRIextension *swrast_loader_noshm_extensions[] = {
+   &swrast_loader_noshm_extension.base,
+   NULL,
+};
+
+/**
+ * MIT-SHM only helps if the server can map our segments, which is not the
+ * case for remote displays. Attach a one page segment to find out.
+ */
+static bool
+dri2_x11_shm_available(struct dri2_egl_display *dri2_dpy)
+{
+   const xcb_query_extension_reply_t *extension;
+   xcb_shm_query_version_reply_t *version;
+   xcb_void_cookie_t cookie;
+   xcb_generic_error_t *error;
+   xcb_shm_seg_t seg;
+   void *addr;
+   int id;
+
+   xcb_prefetch_extension_data(dri2_dpy->conn, &xcb_shm_id);
+   extension = xcb_get_extension_data(dri2_dpy->conn, &xcb_shm_id);
+   if (!(extension && extension->present))
+      return false;
+
+   version = xcb_shm_query_version_reply(dri2_dpy->conn,
+                                         xcb_shm_query_version(dri2_dpy->conn),
+                                         NULL);
+   if (!version)
+      return false;
+   free(version);
+
+   id = shmget(IPC_PRIVATE, 4096, IPC_CREAT | 0600);
+   if (id == -1)
+      return false;
+
+   addr = shmat(id, NULL, 0);
+   if (addr == (void *) -1) {
+      shmctl(id, IPC_RMID, NULL);
+      return false;
+   }
+
+   seg = xcb_generate_id(dri2_dpy->conn);
+   cookie = xcb_shm_attach_checked(dri2_dpy->conn, seg, id, false);
+   error = xcb_request_check(dri2_dpy->conn, cookie);
+   shmctl(id, IPC_RMID, NULL);
+   if (error) {
+      free(error);
+      shmdt(addr);
+      return false;
+   }
+
+   xcb_shm_detach(dri2_dpy->conn, seg);
+   shmdt(addr);
+
+   return true;
+}
+
 static EGLBoolean
 dri2_initialize_x11_swrast(_EGLDriver *drv, _EGLDisplay *disp)
 {
     _eglLog(_EGL_INFO, "Using swrast");
    struct dri2_egl_display *dri2_dpy;
+   const xcb_query_extension_reply_t *extension;
 
    dri2_dpy = calloc(1, sizeof *dri2_dpy);
    if (!dri2_dpy)
@@ -1215,13 +3832,70 @@ dri2_initialize_x11_swrast(_EGLDriver *drv, _EGLDisplay *disp)
    if (!dri2_load_driver_swrast(disp))//通过disp查找并dlopen驱动并绑定扩展
       goto cleanup_conn;
 
-   dri2_dpy->loader_extensions = swrast_loader_extensions;
+   /* Upload only the tiles of each frame that changed. This needs the
+    * server to keep what it was sent: pixmaps always do, but windows only
+    * with backing_store Always, so a typical window still gets whole
+    * frames. Expose events go to the application, not to us, so there is
+    * no way to tell which tiles of other windows were lost.
+    */
+   dri2_dpy->tile_damage = getenv("EGL_SWRAST_TILE_DAMAGE") != NULL;
+
+   /* The presenter thread sends on the display's connection while the
+    * application keeps using it. XCB is thread safe, but the Xlib display
+    * we were handed is only after XInitThreads, which leaves it a lock.
+    */
+   dri2_dpy->conn_thread_safe = disp->PlatformDisplay == NULL ||
+      ((Display *) disp->PlatformDisplay)->lock != NULL;
+   dri2_dpy->async_present = getenv("EGL_SWRAST_ASYNC_PRESENT") != NULL;
+   if (dri2_dpy->async_present && !dri2_dpy->conn_thread_safe) {
+      _eglLog(_EGL_WARNING, "EGL_SWRAST_ASYNC_PRESENT needs XInitThreads, "
+              "ignoring it");
+      dri2_dpy->async_present = false;
+   }
+
+   /* Needed to size PutImage strips; the SHM probe below collects it. */
+   xcb_prefetch_maximum_request_length(dri2_dpy->conn);
+
+   xcb_prefetch_extension_data(dri2_dpy->conn, &xcb_present_id);
+
+   dri2_dpy->has_shm = dri2_x11_shm_available(dri2_dpy);
+   extension = xcb_get_extension_data(dri2_dpy->conn, &xcb_present_id);
+   dri2_dpy->has_present = extension && extension->present;
+
+   /* Swap windows with PresentPixmap on SHM pixmaps, which gives swrast
+    * swap intervals and completion events.
+    */
+   dri2_dpy->present_swap = getenv("EGL_SWRAST_PRESENT") != NULL &&
+                            dri2_dpy->has_present && dri2_dpy->has_shm;
+   if (dri2_dpy->has_shm)
+      dri2_dpy->loader_extensions = swrast_loader_extensions;
+   else
+      dri2_dpy->loader_extensions = swrast_loader_noshm_extensions;
 
    if (!dri2_create_screen(disp))//return TRUE
       goto cleanup_driver;
 
-   if (!dri2_x11_add_configs_for_visuals(dri2_dpy, disp, true))
-      goto cleanup_configs;
+   /* Damage is only a hint, so a full swap is a valid fallback for it;
+    * the region/sub-buffer posts need copySubBuffer to be honoured.
+    */
+   disp->Extensions.EXT_buffer_age = EGL_TRUE;
+   disp->Extensions.EXT_swap_buffers_with_damage = EGL_TRUE;
+   disp->Extensions.KHR_partial_update = EGL_TRUE;
+   if (dri2_dpy->copy_sub_buffer) {
+      disp->Extensions.NOK_swap_region = EGL_TRUE;
+      disp->Extensions.NV_post_sub_buffer = EGL_TRUE;
+   }
+
+   if (dri2_dpy->present_swap) {
+      dri2_x11_setup_swap_interval(dri2_dpy);
+      disp->Extensions.CHROMIUM_sync_control = EGL_TRUE;
+   }
+   disp->Extensions.MESA_present_mailbox = EGL_TRUE;
+
+   /* Walking every visual against every driver config is the bulk of
+    * eglInitialize on swrast; configless users never need the result.
+    */
+   dri2_dpy->configs_deferred = true;
 
    /* Fill vtbl last to prevent accidentally calling virtual function during
     * initialization.
@@ -1230,9 +3904,6 @@ dri2_initialize_x11_swrast(_EGLDriver *drv, _EGLDisplay *disp)
 
    return EGL_TRUE;
 
- cleanup_configs:
-   _eglCleanupDisplay(disp);
-   dri2_dpy->core->destroyScreen(dri2_dpy->dri_screen);
  cleanup_driver:
    dlclose(dri2_dpy->driver);
  cleanup_conn:
@@ -1258,7 +3929,7 @@ dri2_x11_setup_swap_interval(struct dri2_egl_display *dri2_dpy)
    dri2_dpy->min_swap_interval = 0;
    dri2_dpy->max_swap_interval = 0;
 
-   if (!dri2_dpy->swap_available)
+   if (!dri2_dpy->swap_available && !dri2_dpy->present_swap)
       return;
 
    /* If we do have swapbuffers, then we can support pretty much any swap
@@ -1414,6 +4085,13 @@ static const __DRIextension *dri2_loader_extensions[] = {
    NULL,
 };
 
+static const __DRIextension *dri2_loader_extensions_invalidate[] = {
+   &dri2_loader_extension.base,
+   &image_lookup_extension.base,
+   &use_invalidate.base,
+   NULL,
+};
+
 static EGLBoolean
 dri2_initialize_x11_dri2(_EGLDriver *drv, _EGLDisplay *disp)
 {
@@ -1445,17 +4123,32 @@ dri2_initialize_x11_dri2(_EGLDriver *drv, _EGLDisplay *disp)
    if (!dri2_load_driver(disp))
       goto cleanup_fd;
 
-   if (dri2_dpy->dri2_minor >= 1)
+   dri2_dpy->swap_available = (dri2_dpy->dri2_minor >= 2);
+   dri2_dpy->invalidate_available = (dri2_dpy->dri2_minor >= 3);
+
+   /* How stale, in milliseconds, eglGetSyncValuesCHROMIUM may let its last
+    * GetMSC reply get before asking the server again.
+    */
+   if (getenv("EGL_SYNC_VALUES_MAX_AGE"))
+      dri2_dpy->sync_values_max_age =
+         (int64_t) atoi(getenv("EGL_SYNC_VALUES_MAX_AGE")) * 1000;
+
+   /* Invalidate events can only be relied on when they come through Xlib. */
+   if (dri2_dpy->invalidate_available && disp->PlatformDisplay)
+      dri2_dpy->loader_extensions = dri2_loader_extensions_invalidate;
+   else if (dri2_dpy->dri2_minor >= 1)
       dri2_dpy->loader_extensions = dri2_loader_extensions;
    else
       dri2_dpy->loader_extensions = dri2_loader_extensions_old;
 
-   dri2_dpy->swap_available = (dri2_dpy->dri2_minor >= 2);
-   dri2_dpy->invalidate_available = (dri2_dpy->dri2_minor >= 3);
-
    if (!dri2_create_screen(disp))
       goto cleanup_driver;
 
+   if (dri2_dpy->loader_extensions == dri2_loader_extensions_invalidate &&
+       dri2_dpy->flush && dri2_dpy->flush->base.version >= 3 &&
+       dri2_dpy->flush->invalidate)
+      dri2_x11_hook_invalidate(dri2_dpy, disp->PlatformDisplay);
+
    dri2_x11_setup_swap_interval(dri2_dpy);
 
    disp->Extensions.KHR_image_pixmap = EGL_TRUE;
@@ -89,6 +89,24 @@ typedef EGLBoolean (EGLAPIENTRYP PFNEGLSWAPBUFFERSREGIONNOK) (EGLDisplay dpy, EG
 #define EGL_PLATFORM_SURFACELESS_MESA           0x31DD
 #endif /* EGL_MESA_platform_surfaceless */
 
+#ifndef EGL_MESA_present_mailbox
+#define EGL_MESA_present_mailbox 1
+/* Not registered with Khronos. 0x31DE was taken by
+ * EGL_PLATFORM_XCB_SCREEN_EXT; this is the top of the range egl.xml still
+ * reserves for future use, which sequential block allocation reaches
+ * last. It has to move to a registered value before it can be relied on.
+ */
+#define EGL_PRESENT_MAILBOX_MESA                0x3FFF
+#endif /* EGL_MESA_present_mailbox */
+
+#ifndef EGL_MESA_swap_buffers_multi
+#define EGL_MESA_swap_buffers_multi 1
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLSWAPBUFFERSMULTIMESAPROC) (EGLDisplay dpy, EGLint n_surfaces, const EGLSurface *surfaces, const EGLint *const *rects, const EGLint *n_rects);
+#ifdef EGL_EGLEXT_PROTOTYPES
+EGLAPI EGLBoolean EGLAPIENTRY eglSwapBuffersMultiMESA (EGLDisplay dpy, EGLint n_surfaces, const EGLSurface *surfaces, const EGLint *const *rects, const EGLint *n_rects);
+#endif
+#endif /* EGL_MESA_swap_buffers_multi */
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,17 +32,19 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
 #ifdef MAJOR_IN_MKDEV
 #include <sys/mkdev.h>
 #endif
 #ifdef MAJOR_IN_SYSMACROS
 #include <sys/sysmacros.h>
 #endif
+#include "c11/threads.h"
 #include "loader.h"
 
 #ifdef HAVE_LIBDRM
-#include <stdlib.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #ifdef USE_DRICONF
@@ -153,15 +155,82 @@ static char *drm_get_id_path_tag_for_fd(int fd)
    return tag;
 }
 
+/* Enumerating the DRM devices and building their id-path tags walks sysfs,
+ * so remember which render node the last default device and prime choice
+ * resolved to. Only hits are kept: the device asked for may be plugged in
+ * later, and opening the cached node fails once it is gone.
+ */
+static struct {
+   dev_t default_rdev;
+   char *prime;
+   char *node;
+   int different_device;
+} preferred_fd_cache;
+static mtx_t preferred_fd_cache_mutex = _MTX_INITIALIZER_NP;
+
+static void
+preferred_fd_cache_store(dev_t default_rdev, const char *prime,
+                         const char *node, int different_device)
+{
+   mtx_lock(&preferred_fd_cache_mutex);
+   free(preferred_fd_cache.prime);
+   free(preferred_fd_cache.node);
+   preferred_fd_cache.default_rdev = default_rdev;
+   preferred_fd_cache.prime = strdup(prime);
+   preferred_fd_cache.node = strdup(node);
+   preferred_fd_cache.different_device = different_device;
+   if (!preferred_fd_cache.node) {
+      free(preferred_fd_cache.prime);
+      preferred_fd_cache.prime = NULL;
+   }
+   mtx_unlock(&preferred_fd_cache_mutex);
+}
+
+/**
+ * Look up the cached choice for this default device and prime value.
+ * Returns false on a miss; on a hit *node is a copy of the cached node.
+ */
+static bool
+preferred_fd_cache_lookup(dev_t default_rdev, const char *prime,
+                          char **node, int *different_device)
+{
+   bool hit = false;
+
+   mtx_lock(&preferred_fd_cache_mutex);
+   if (preferred_fd_cache.prime &&
+       preferred_fd_cache.default_rdev == default_rdev &&
+       !strcmp(preferred_fd_cache.prime, prime)) {
+      *node = strdup(preferred_fd_cache.node);
+      *different_device = preferred_fd_cache.different_device;
+      hit = *node != NULL;
+   }
+   mtx_unlock(&preferred_fd_cache_mutex);
+
+   return hit;
+}
+
+static void
+preferred_fd_cache_clear(void)
+{
+   mtx_lock(&preferred_fd_cache_mutex);
+   free(preferred_fd_cache.prime);
+   free(preferred_fd_cache.node);
+   preferred_fd_cache.prime = NULL;
+   preferred_fd_cache.node = NULL;
+   mtx_unlock(&preferred_fd_cache_mutex);
+}
+
 int loader_get_user_preferred_fd(int default_fd, int *different_device)
 {
 /* Arbitrary "maximum" value of drm devices. */
 #define MAX_DRM_DEVICES 32
    const char *dri_prime = getenv("DRI_PRIME");
-   char *default_tag, *prime = NULL;
+   char *default_tag = NULL, *prime = NULL, *node = NULL;
    drmDevicePtr devices[MAX_DRM_DEVICES];
-   int i, num_devices, fd;
+   int i, num_devices, fd, different;
    bool found = false;
+   struct stat buf;
+   bool cacheable, cached = false;
 
    if (dri_prime)
       prime = strdup(dri_prime);
@@ -175,6 +244,14 @@ int loader_get_user_preferred_fd(int default_fd, int *different_device)
       return default_fd;
    }
 
+   cacheable = fstat(default_fd, &buf) == 0 && S_ISCHR(buf.st_mode);
+   if (cacheable &&
+       preferred_fd_cache_lookup(buf.st_rdev, prime, &node, &different)) {
+      cached = true;
+      goto open;
+   }
+
+enumerate:
    default_tag = drm_get_id_path_tag_for_fd(default_fd);
    if (default_tag == NULL)
       goto err;
@@ -211,25 +288,39 @@ int loader_get_user_preferred_fd(int default_fd, int *different_device)
       }
    }
 
-   if (!found) {
-      drmFreeDevices(devices, num_devices);
+   if (found)
+      node = strdup(devices[i]->nodes[DRM_NODE_RENDER]);
+   drmFreeDevices(devices, num_devices);
+   different = !!strcmp(default_tag, prime);
+
+   if (node == NULL)
       goto err;
-   }
 
-   fd = loader_open_device(devices[i]->nodes[DRM_NODE_RENDER]);
-   drmFreeDevices(devices, num_devices);
+   if (cacheable)
+      preferred_fd_cache_store(buf.st_rdev, prime, node, different);
+
+open:
+   fd = loader_open_device(node);
+   free(node);
+   node = NULL;
+   if (fd < 0 && cached) {
+      /* the device went away; look again */
+      preferred_fd_cache_clear();
+      cached = false;
+      goto enumerate;
+   }
    if (fd < 0)
       goto err;
 
    close(default_fd);
 
-   *different_device = !!strcmp(default_tag, prime);
+   *different_device = different;
 
    free(default_tag);
    free(prime);
    return fd;
 
- err:
+err:
    *different_device = 0;
 
    free(default_tag);
@@ -269,17 +360,76 @@ dev_node_from_fd(int fd, unsigned int *maj, unsigned int *min)
 
 #if defined(HAVE_LIBDRM)
 
+/* drmGetDevice() walks sysfs on every call, so remember the PCI id of the
+ * last few device nodes we looked at, keyed by their dev_t.
+ */
+#define PCI_ID_CACHE_SIZE 8
+
+static struct {
+   dev_t rdev;
+   int vendor_id;
+   int chip_id;
+} pci_id_cache[PCI_ID_CACHE_SIZE];
+static unsigned pci_id_cache_count, pci_id_cache_next;
+static mtx_t pci_id_cache_mutex = _MTX_INITIALIZER_NP;
+
+static int
+pci_id_cache_lookup(dev_t rdev, int *vendor_id, int *chip_id)
+{
+   unsigned i;
+   int found = 0;
+
+   mtx_lock(&pci_id_cache_mutex);
+   for (i = 0; i < pci_id_cache_count; i++) {
+      if (pci_id_cache[i].rdev == rdev) {
+         *vendor_id = pci_id_cache[i].vendor_id;
+         *chip_id = pci_id_cache[i].chip_id;
+         found = 1;
+         break;
+      }
+   }
+   mtx_unlock(&pci_id_cache_mutex);
+
+   return found;
+}
+
+static void
+pci_id_cache_insert(dev_t rdev, int vendor_id, int chip_id)
+{
+   unsigned slot;
+
+   mtx_lock(&pci_id_cache_mutex);
+   slot = pci_id_cache_next;
+   pci_id_cache_next = (pci_id_cache_next + 1) % PCI_ID_CACHE_SIZE;
+   if (pci_id_cache_count < PCI_ID_CACHE_SIZE)
+      pci_id_cache_count++;
+
+   pci_id_cache[slot].rdev = rdev;
+   pci_id_cache[slot].vendor_id = vendor_id;
+   pci_id_cache[slot].chip_id = chip_id;
+   mtx_unlock(&pci_id_cache_mutex);
+}
+
 static int
 drm_get_pci_id_for_fd(int fd, int *vendor_id, int *chip_id)
 {
    drmDevicePtr device;
+   struct stat buf;
+   int cacheable;
    int ret;
 
+   cacheable = fstat(fd, &buf) == 0 && S_ISCHR(buf.st_mode);
+   if (cacheable && pci_id_cache_lookup(buf.st_rdev, vendor_id, chip_id))
+      return 1;
+
    if (drmGetDevice(fd, &device) == 0) {
       if (device->bustype == DRM_BUS_PCI) {
          *vendor_id = device->deviceinfo.pci->vendor_id;
          *chip_id = device->deviceinfo.pci->device_id;
          ret = 1;
+
+         if (cacheable)
+            pci_id_cache_insert(buf.st_rdev, *vendor_id, *chip_id);
       }
       else {
          log_(_LOADER_WARNING, "MESA-LOADER: device is not located on the PCI bus\n");
@@ -339,10 +489,100 @@ loader_get_device_name_for_fd(int fd)
    return result;
 }
 
+/* Every (vendor, chip) pair listed in driver_map, sorted so that a lookup
+ * is a binary search rather than a walk over each driver's chip list.
+ */
+struct pci_id_index_entry {
+   uint16_t vendor_id;
+   uint16_t chip_id;
+   int driver;        /* index into driver_map */
+};
+
+static struct pci_id_index_entry *pci_id_index;
+static unsigned pci_id_index_size;
+static once_flag pci_id_index_once = ONCE_FLAG_INIT;
+
+static int
+pci_id_index_compare(const void *a, const void *b)
+{
+   const struct pci_id_index_entry *ea = a, *eb = b;
+
+   if (ea->vendor_id != eb->vendor_id)
+      return ea->vendor_id - eb->vendor_id;
+   if (ea->chip_id != eb->chip_id)
+      return ea->chip_id - eb->chip_id;
+   /* keep driver_map order for ids claimed by more than one driver */
+   return ea->driver - eb->driver;
+}
+
+static void
+pci_id_index_init(void)
+{
+   unsigned count = 0;
+   int i, j;
+
+   for (i = 0; driver_map[i].driver; i++) {
+      if (driver_map[i].num_chips_ids > 0)
+         count += driver_map[i].num_chips_ids;
+   }
+
+   pci_id_index = malloc(count * sizeof(*pci_id_index));
+   if (!pci_id_index)
+      return;
+
+   for (i = 0; driver_map[i].driver; i++) {
+      for (j = 0; j < driver_map[i].num_chips_ids; j++) {
+         pci_id_index[pci_id_index_size].vendor_id = driver_map[i].vendor_id;
+         pci_id_index[pci_id_index_size].chip_id = driver_map[i].chip_ids[j];
+         pci_id_index[pci_id_index_size].driver = i;
+         pci_id_index_size++;
+      }
+   }
+
+   qsort(pci_id_index, pci_id_index_size, sizeof(*pci_id_index),
+         pci_id_index_compare);
+}
+
+/**
+ * Find the index entries for the given PCI id, one per driver whose chip
+ * list contains it, in driver_map order. Returns the first of *count.
+ */
+static const struct pci_id_index_entry *
+pci_id_index_lookup(int vendor_id, int chip_id, unsigned *count)
+{
+   unsigned lo = 0, hi;
+
+   call_once(&pci_id_index_once, pci_id_index_init);
+
+   /* lower bound on (vendor_id, chip_id) */
+   hi = pci_id_index_size;
+   while (lo < hi) {
+      unsigned mid = lo + (hi - lo) / 2;
+      const struct pci_id_index_entry *e = &pci_id_index[mid];
+
+      if (e->vendor_id < vendor_id ||
+          (e->vendor_id == vendor_id && e->chip_id < chip_id))
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   for (hi = lo; hi < pci_id_index_size; hi++) {
+      if (pci_id_index[hi].vendor_id != vendor_id ||
+          pci_id_index[hi].chip_id != chip_id)
+         break;
+   }
+
+   *count = hi - lo;
+   return &pci_id_index[lo];
+}
+
 char *
 loader_get_driver_for_fd(int fd)
 {
-   int vendor_id, chip_id, i, j;
+   const struct pci_id_index_entry *match;
+   int vendor_id, chip_id, i;
+   unsigned num_matches;
    char *driver = NULL;
 
    if (!loader_get_pci_id_for_fd(fd, &vendor_id, &chip_id)) {
@@ -365,26 +605,41 @@ loader_get_driver_for_fd(int fd)
       return driver;
    }
 
+   match = pci_id_index_lookup(vendor_id, chip_id, &num_matches);
+
    for (i = 0; driver_map[i].driver; i++) {
       if (vendor_id != driver_map[i].vendor_id)
          continue;
 
-      if (driver_map[i].predicate && !driver_map[i].predicate(fd))
-         continue;
+      /* Drivers with an explicit chip list only match through the index,
+       * whose entries for the id come in the same order as driver_map.
+       * Without an index, scan the list as before.
+       */
+      if (driver_map[i].num_chips_ids != -1 && !pci_id_index) {
+         int j;
 
-      if (driver_map[i].num_chips_ids == -1) {
-         driver = strdup(driver_map[i].driver);
-         goto out;
+         for (j = 0; j < driver_map[i].num_chips_ids; j++) {
+            if (driver_map[i].chip_ids[j] == chip_id)
+               break;
+         }
+         if (j == driver_map[i].num_chips_ids)
+            continue;
+      } else if (driver_map[i].num_chips_ids != -1) {
+         while (num_matches && match->driver < i) {
+            match++;
+            num_matches--;
+         }
+         if (!num_matches || match->driver != i)
+            continue;
       }
 
-      for (j = 0; j < driver_map[i].num_chips_ids; j++)
-         if (driver_map[i].chip_ids[j] == chip_id) {
-            driver = strdup(driver_map[i].driver);
-            goto out;
-         }
+      if (driver_map[i].predicate && !driver_map[i].predicate(fd))
+         continue;
+
+      driver = strdup(driver_map[i].driver);
+      break;
    }
 
-out:
    log_(driver ? _LOADER_DEBUG : _LOADER_WARNING,
          "pci id for fd %d: %04x:%04x, driver %s\n",
          fd, vendor_id, chip_id, driver);
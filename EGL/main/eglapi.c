@@ -502,6 +502,7 @@ _eglCreateExtensionsString(_EGLDisplay *dpy)
    _EGL_CHECK_EXTENSION(KHR_image_base);
    _EGL_CHECK_EXTENSION(KHR_image_pixmap);
    _EGL_CHECK_EXTENSION(KHR_no_config_context);
+   _EGL_CHECK_EXTENSION(KHR_partial_update);
    _EGL_CHECK_EXTENSION(KHR_reusable_sync);
    _EGL_CHECK_EXTENSION(KHR_surfaceless_context);
    if (dpy->Extensions.EXT_swap_buffers_with_damage)
@@ -512,6 +513,8 @@ _eglCreateExtensionsString(_EGLDisplay *dpy)
       _eglAppendExtension(&exts, "EGL_MESA_configless_context");
    _EGL_CHECK_EXTENSION(MESA_drm_image);
    _EGL_CHECK_EXTENSION(MESA_image_dma_buf_export);
+   _EGL_CHECK_EXTENSION(MESA_present_mailbox);
+   _EGL_CHECK_EXTENSION(MESA_swap_buffers_multi);
 
    _EGL_CHECK_EXTENSION(NOK_swap_region);
    _EGL_CHECK_EXTENSION(NOK_texture_from_pixmap);
@@ -1191,6 +1194,47 @@ eglSwapInterval(EGLDisplay dpy, EGLint interval)
 }
 
 
+/**
+ * EGL_KHR_partial_update: declare which parts of the back buffer the next
+ * frame will touch. Only valid once per frame, after the buffer age has
+ * been queried.
+ */
+static EGLBoolean EGLAPIENTRY
+eglSetDamageRegionKHR(EGLDisplay dpy, EGLSurface surface,
+                      EGLint *rects, EGLint n_rects)
+{
+   _EGLContext *ctx = _eglGetCurrentContext();
+   _EGLDisplay *disp = _eglLockDisplay(dpy);
+   _EGLSurface *surf = _eglLookupSurface(surface, disp);
+   _EGLDriver *drv;
+   EGLBoolean ret;
+
+   _EGL_FUNC_START(disp, EGL_OBJECT_SURFACE_KHR, surf, EGL_FALSE);
+   _EGL_CHECK_SURFACE(disp, surf, EGL_FALSE, drv);
+
+   if (!disp->Extensions.KHR_partial_update)
+      RETURN_EGL_ERROR(disp, EGL_BAD_DISPLAY, EGL_FALSE);
+
+   if (_eglGetContextHandle(ctx) == EGL_NO_CONTEXT ||
+       surf->Type != EGL_WINDOW_BIT ||
+       ctx->DrawSurface != surf ||
+       surf->SwapBehavior != EGL_BUFFER_DESTROYED)
+      RETURN_EGL_ERROR(disp, EGL_BAD_MATCH, EGL_FALSE);
+
+   if (surf->SetDamageRegionCalled || !surf->BufferAgeRead)
+      RETURN_EGL_ERROR(disp, EGL_BAD_ACCESS, EGL_FALSE);
+
+   if ((n_rects > 0 && rects == NULL) || n_rects < 0)
+      RETURN_EGL_ERROR(disp, EGL_BAD_PARAMETER, EGL_FALSE);
+
+   ret = drv->API.SetDamageRegion(drv, disp, surf, rects, n_rects);
+   if (ret)
+      surf->SetDamageRegionCalled = EGL_TRUE;
+
+   RETURN_EGL_EVAL(disp, ret);
+}
+
+
 EGLBoolean EGLAPIENTRY
 eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
 {
@@ -1212,6 +1256,14 @@ eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
 
    ret = drv->API.SwapBuffers(drv, disp, surf);
 
+   /* EGL_KHR_partial_update: the damage region and the buffer age query
+    * only apply to the frame that was just posted.
+    */
+   if (ret) {
+      surf->SetDamageRegionCalled = EGL_FALSE;
+      surf->BufferAgeRead = EGL_FALSE;
+   }
+
    RETURN_EGL_EVAL(disp, ret);
 }
 
@@ -1236,6 +1288,11 @@ eglSwapBuffersWithDamageCommon(_EGLDisplay *disp, _EGLSurface *surf,
 
    ret = drv->API.SwapBuffersWithDamageEXT(drv, disp, surf, rects, n_rects);
 
+   if (ret) {
+      surf->SetDamageRegionCalled = EGL_FALSE;
+      surf->BufferAgeRead = EGL_FALSE;
+   }
+
    RETURN_EGL_EVAL(disp, ret);
 }
 
@@ -1905,6 +1962,90 @@ eglSwapBuffersRegionNOK(EGLDisplay dpy, EGLSurface surface,
 
    ret = drv->API.SwapBuffersRegionNOK(drv, disp, surf, numRects, rects);
 
+   if (ret) {
+      surf->SetDamageRegionCalled = EGL_FALSE;
+      surf->BufferAgeRead = EGL_FALSE;
+   }
+
+   RETURN_EGL_EVAL(disp, ret);
+}
+
+
+/**
+ * Swap several surfaces at once, so the driver can batch the work. Unlike
+ * eglSwapBuffers the surfaces need not be bound, but flushing them takes a
+ * current context on this display, and a surface bound to any other
+ * context fails with EGL_BAD_ACCESS: another thread may be rendering to it.
+ * A NULL n_rects swaps every surface in full; otherwise rects[i] holds
+ * n_rects[i] damage rectangles for surfaces[i], as for
+ * eglSwapBuffersWithDamageKHR.
+ */
+static EGLBoolean EGLAPIENTRY
+eglSwapBuffersMultiMESA(EGLDisplay dpy, EGLint n_surfaces,
+                        const EGLSurface *surfaces,
+                        const EGLint *const *rects, const EGLint *n_rects)
+{
+   _EGLContext *ctx = _eglGetCurrentContext();
+   _EGLDisplay *disp = _eglLockDisplay(dpy);
+   _EGLSurface **surfs;
+   _EGLDriver *drv;
+   EGLBoolean ret;
+   EGLint err = EGL_SUCCESS;
+   EGLint i, j;
+
+   _EGL_FUNC_START(disp, EGL_OBJECT_DISPLAY_KHR, NULL, EGL_FALSE);
+
+   _EGL_CHECK_DISPLAY(disp, EGL_FALSE, drv);
+
+   if (!disp->Extensions.MESA_swap_buffers_multi)
+      RETURN_EGL_EVAL(disp, EGL_FALSE);
+
+   if (n_surfaces < 0 || (n_surfaces > 0 && !surfaces))
+      RETURN_EGL_ERROR(disp, EGL_BAD_PARAMETER, EGL_FALSE);
+   if (n_surfaces == 0)
+      RETURN_EGL_SUCCESS(disp, EGL_TRUE);
+
+   if (_eglGetContextHandle(ctx) == EGL_NO_CONTEXT ||
+       ctx->Resource.Display != disp)
+      RETURN_EGL_ERROR(disp, EGL_BAD_CONTEXT, EGL_FALSE);
+
+   surfs = malloc(n_surfaces * sizeof(*surfs));
+   if (!surfs)
+      RETURN_EGL_ERROR(disp, EGL_BAD_ALLOC, EGL_FALSE);
+
+   for (i = 0; i < n_surfaces && err == EGL_SUCCESS; i++) {
+      surfs[i] = _eglLookupSurface(surfaces[i], disp);
+      if (!surfs[i])
+         err = EGL_BAD_SURFACE;
+      else if (surfs[i]->CurrentContext && surfs[i]->CurrentContext != ctx)
+         err = EGL_BAD_ACCESS;
+      else if (n_rects && (n_rects[i] < 0 ||
+                           (n_rects[i] > 0 && (!rects || !rects[i]))))
+         err = EGL_BAD_PARAMETER;
+
+      /* one surface cannot be swapped twice in the same call */
+      for (j = 0; j < i && err == EGL_SUCCESS; j++) {
+         if (surfs[j] == surfs[i])
+            err = EGL_BAD_PARAMETER;
+      }
+   }
+
+   if (err != EGL_SUCCESS) {
+      free(surfs);
+      RETURN_EGL_ERROR(disp, err, EGL_FALSE);
+   }
+
+   ret = drv->API.SwapBuffersMultiMESA(drv, disp, n_surfaces, surfs,
+                                       rects, n_rects);
+
+   if (ret) {
+      for (i = 0; i < n_surfaces; i++) {
+         surfs[i]->SetDamageRegionCalled = EGL_FALSE;
+         surfs[i]->BufferAgeRead = EGL_FALSE;
+      }
+   }
+   free(surfs);
+
    RETURN_EGL_EVAL(disp, ret);
 }
 
@@ -2057,6 +2198,11 @@ eglPostSubBufferNV(EGLDisplay dpy, EGLSurface surface,
 
    ret = drv->API.PostSubBufferNV(drv, disp, surf, x, y, width, height);
 
+   if (ret) {
+      surf->SetDamageRegionCalled = EGL_FALSE;
+      surf->BufferAgeRead = EGL_FALSE;
+   }
+
    RETURN_EGL_EVAL(disp, ret);
 }
 
@@ -2337,6 +2483,7 @@ eglGetProcAddress(const char *procname)
       { "eglSignalSyncKHR", (_EGLProc) eglSignalSyncKHR },
       { "eglGetSyncAttribKHR", (_EGLProc) eglGetSyncAttribKHR },
       { "eglSwapBuffersRegionNOK", (_EGLProc) eglSwapBuffersRegionNOK },
+      { "eglSwapBuffersMultiMESA", (_EGLProc) eglSwapBuffersMultiMESA },
       { "eglCreateDRMImageMESA", (_EGLProc) eglCreateDRMImageMESA },
       { "eglExportDRMImageMESA", (_EGLProc) eglExportDRMImageMESA },
       { "eglBindWaylandDisplayWL", (_EGLProc) eglBindWaylandDisplayWL },
@@ -2346,6 +2493,7 @@ eglGetProcAddress(const char *procname)
       { "eglPostSubBufferNV", (_EGLProc) eglPostSubBufferNV },
       { "eglSwapBuffersWithDamageEXT", (_EGLProc) eglSwapBuffersWithDamageEXT },
       { "eglSwapBuffersWithDamageKHR", (_EGLProc) eglSwapBuffersWithDamageKHR },
+      { "eglSetDamageRegionKHR", (_EGLProc) eglSetDamageRegionKHR },
       { "eglGetPlatformDisplayEXT", (_EGLProc) eglGetPlatformDisplayEXT },
       { "eglCreatePlatformWindowSurfaceEXT", (_EGLProc) eglCreatePlatformWindowSurfaceEXT },
       { "eglCreatePlatformPixmapSurfaceEXT", (_EGLProc) eglCreatePlatformPixmapSurfaceEXT },
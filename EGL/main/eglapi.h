@@ -188,6 +188,12 @@ struct _egl_api
    EGLBoolean (*SwapBuffersRegionNOK)(_EGLDriver *drv, _EGLDisplay *disp,
                                       _EGLSurface *surf, EGLint numRects,
                                       const EGLint *rects);
+    //egl_dri2.c : dri2_swap_buffers_multi
+   EGLBoolean (*SwapBuffersMultiMESA)(_EGLDriver *drv, _EGLDisplay *disp,
+                                      EGLint n_surfaces,
+                                      _EGLSurface **surfaces,
+                                      const EGLint *const *rects,
+                                      const EGLint *n_rects);
     //eglfallbacks.c : NULL
    _EGLImage *(*CreateDRMImageMESA)(_EGLDriver *drv, _EGLDisplay *disp,
                                     const EGLint *attr_list);
@@ -224,6 +230,10 @@ struct _egl_api
     //egl_dri2.c : dri2_query_buffer_age
    EGLint (*QueryBufferAge)(_EGLDriver *drv,
                             _EGLDisplay *dpy, _EGLSurface *surface);
+    //egl_dri2.c : dri2_set_damage_region
+   EGLBoolean (*SetDamageRegion)(_EGLDriver *drv, _EGLDisplay *dpy,
+                                 _EGLSurface *surface,
+                                 EGLint *rects, EGLint n_rects);
     //egl_dri2.c : dri2_get_sync_values_chromium
    EGLBoolean (*GetSyncValuesCHROMIUM)(_EGLDisplay *dpy, _EGLSurface *surface,
                                        EGLuint64KHR *ust, EGLuint64KHR *msc,
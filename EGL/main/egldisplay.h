@@ -115,12 +115,15 @@ struct _egl_extensions
    EGLBoolean KHR_image_base;    //false
    EGLBoolean KHR_image_pixmap;  //false
    EGLBoolean KHR_no_config_context;   //true
+   EGLBoolean KHR_partial_update;
    EGLBoolean KHR_reusable_sync;    //true
    EGLBoolean KHR_surfaceless_context;    //true
    EGLBoolean KHR_wait_sync;     //false
 
    EGLBoolean MESA_drm_image;    //false
    EGLBoolean MESA_image_dma_buf_export;  //false
+   EGLBoolean MESA_present_mailbox;
+   EGLBoolean MESA_swap_buffers_multi;
 
    EGLBoolean NOK_swap_region;
    EGLBoolean NOK_texture_from_pixmap;
@@ -97,6 +97,8 @@ _eglInitDriverFallbacks(_EGLDriver *drv)
    drv->API.ExportDRMImageMESA = NULL;
 
    drv->API.SwapBuffersRegionNOK = NULL;
+   drv->API.SwapBuffersMultiMESA = NULL;
+   drv->API.SetDamageRegion = (void*) _eglReturnFalse;
 
    drv->API.ExportDMABUFImageQueryMESA = NULL;
    drv->API.ExportDMABUFImageMESA = NULL;
@@ -81,6 +81,14 @@ struct _egl_surface
    EGLBoolean BoundToTexture;
 
    EGLBoolean PostSubBufferSupportedNV;
+
+   /* EGL_MESA_present_mailbox: at swap interval 0 a newer frame replaces
+    * one that has not been shown yet instead of queueing behind it */
+   EGLBoolean PresentMailbox;
+
+   /* EGL_KHR_partial_update: per-frame state, reset by the swap */
+   EGLBoolean SetDamageRegionCalled;
+   EGLBoolean BufferAgeRead;
 };
 
 